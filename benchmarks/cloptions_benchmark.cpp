@@ -0,0 +1,281 @@
+//
+//  cloptions_benchmark.cpp
+//  CLOptions
+//
+//  Compile with:
+//      g++ -std=c++11 -O2 -pthread -I../include cloptions_benchmark.cpp -o cloptions_benchmark
+//  or build the 'cloptions_benchmark' target with CMake.
+//
+//  Description:
+//      Measures the hot paths of CLOptions:
+//        - parse  : 'ParseCommandLine' with N registered options and M argv tokens
+//        - file   : 'FillFromFile' on synthetic configuration files of increasing size
+//                   (also with lazy conversion)
+//        - lookup : 'AsInt', 'AsDouble', 'AsString' and 'operator[]' by name
+//        - help   : 'PrintHelp' with and without the cached text (written to /dev/null)
+//        - batch  : 1000 command lines parsed with 'CLBatchParser', compared with
+//                   defining the options and parsing them again for every one
+//                   (the time is per command line)
+//      Every measurement is printed as one JSON object per line, so that the
+//      results can be collected and compared between releases, e.g.
+//        {"benchmark":"parse","options":100,"tokens":100,"iterations":4096,"ns_per_op":5123.4}
+//
+//  Execute with:
+//      ./cloptions_benchmark [--MinTime 0.2] [--MaxOptions 1000] [--MaxTokens 1000] [--MaxLines 100000]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "CLOptionsBatch.h"
+
+//__________________________________________________
+// Exposes the protected config file loader
+class BenchOptions : public CLOptions {
+public:
+    bool Fill(const std::string& filename) {return FillFromFile(filename) ;}
+};
+
+//__________________________________________________
+// Runs 'func' in batches of increasing size until at least 'min_time'
+// seconds have been spent in a single batch. Returns the number of
+// nanoseconds per call and the number of calls in 'iterations'.
+template <typename Func>
+double NanosPerOp(double min_time, long& iterations, Func func)
+{
+    for (iterations=1; ; iterations*=2) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() ;
+        for (long i=0; i<iterations; i++) func() ;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start ;
+        if ((elapsed.count() >= min_time) || (iterations >= (1L << 40))) {
+            return 1.0e9 * elapsed.count() / iterations ;
+        }
+    }
+}
+
+//__________________________________________________
+void Report(const char* benchmark, const char* size_name, long size,
+            const char* size2_name, long size2, long iterations, double ns_per_op)
+{
+    std::printf("{\"benchmark\":\"%s\",\"%s\":%ld,", benchmark, size_name, size) ;
+    if (size2_name != 0) std::printf("\"%s\":%ld,", size2_name, size2) ;
+    std::printf("\"iterations\":%ld,\"ns_per_op\":%.1f}\n", iterations, ns_per_op) ;
+    std::fflush(stdout) ;
+}
+
+//__________________________________________________
+// Register 'n_params' parameters, cycling through the parameter types
+void DefineParams(CLOptions& options, int n_params)
+{
+    options.AddConfigFileParam() ;
+    for (int i=0; i<n_params; i++) {
+        std::string name = "Param" + std::to_string(i) ;
+        std::string desc = "Description of parameter number " + std::to_string(i) +
+                           ", which is long enough to be wrapped over more than one line in the help text." ;
+        switch (i % 4) {
+            case 0: options.AddIntParam(name, desc, 0) ; break ;
+            case 1: options.AddDoubleParam(name, desc, 0.0) ; break ;
+            case 2: options.AddBoolParam(name, desc, false) ; break ;
+            case 3: options.AddStringParam(name, desc, "") ; break ;
+        }
+    }
+}
+
+//__________________________________________________
+// Text value matching the type of parameter 'par'
+std::string ParamValue(int par, int i)
+{
+    switch (par % 4) {
+        case 0: return std::to_string(i) ;
+        case 1: return std::to_string(i * 0.001) ;
+        case 2: return std::to_string(i % 2) ;
+        default: return "value_" + std::to_string(i) ;
+    }
+}
+
+//__________________________________________________
+void BenchParse(int n_params, int n_tokens, double min_time)
+{
+    CLOptions options ;
+    DefineParams(options, n_params) ;
+
+    // Half of the tokens are option names and half are their values
+    std::vector<std::string> args(1, "cloptions_benchmark") ;
+    for (int i=0; i<n_tokens/2; i++) {
+        int par = i % n_params ;
+        args.push_back("--Param" + std::to_string(par)) ;
+        args.push_back(ParamValue(par, i)) ;
+    }
+    std::vector<char*> argv ;
+    for (size_t i=0; i<args.size(); i++) argv.push_back(&args[i][0]) ;
+    argv.push_back(0) ;
+
+    long iterations(0) ;
+    double ns = NanosPerOp(min_time, iterations, [&]() {
+        options.ParseCommandLine(int(args.size()), &argv[0]) ;
+    }) ;
+    Report("parse", "options", n_params, "tokens", n_tokens, iterations, ns) ;
+}
+
+//__________________________________________________
+void BenchFile(int n_params, int n_lines, double min_time)
+{
+    const std::string filename = "cloptions_benchmark.txt" ;
+    {
+        std::ofstream config(filename.c_str()) ;
+        for (int i=0; i<n_lines; i++) {
+            if (i % 10 == 0) {
+                config << "# Comment line number " << i << "\n" ;
+                continue ;
+            }
+            int par = i % n_params ;
+            config << "Param" << par << " " << ParamValue(par, i) << "\n" ;
+        }
+    }
+
+    BenchOptions options ;
+    DefineParams(options, n_params) ;
+    long iterations(0) ;
+    double ns = NanosPerOp(min_time, iterations, [&]() {options.Fill(filename) ;}) ;
+    Report("file", "lines", n_lines, "options", n_params, iterations, ns) ;
+    
+    // Same again, but only converting the values when they're read
+    BenchOptions lazy ;
+    DefineParams(lazy, n_params) ;
+    lazy.SetLazyConversion(true) ;
+    ns = NanosPerOp(min_time, iterations, [&]() {lazy.Fill(filename) ;}) ;
+    Report("file_lazy", "lines", n_lines, "options", n_params, iterations, ns) ;
+    std::remove(filename.c_str()) ;
+}
+
+//__________________________________________________
+void BenchLookup(int n_params, double min_time)
+{
+    CLOptions options ;
+    DefineParams(options, n_params) ;
+    std::vector<std::string> names ;
+    for (int i=0; i<n_params; i++) names.push_back("Param" + std::to_string(i)) ;
+
+    // Make sure the compiler cant throw away the lookups
+    volatile double sink = 0 ;
+    size_t next = 0 ;
+    long iterations(0) ;
+    double ns = NanosPerOp(min_time, iterations, [&]() {
+        const std::string& name = names[next] ;
+        switch (next % 4) {
+            case 0: sink = sink + options.AsInt(name) ; break ;
+            case 1: sink = sink + options.AsDouble(name) ; break ;
+            case 2: sink = sink + options.AsBool(name) ; break ;
+            case 3: sink = sink + options.AsString(name).size() ; break ;
+        }
+        next = (next+1 == names.size()) ? 0 : next+1 ;
+    }) ;
+    Report("lookup_typed", "options", n_params, 0, 0, iterations, ns) ;
+
+    ns = NanosPerOp(min_time, iterations, [&]() {
+        sink = sink + options[names[next]].size() ;
+        next = (next+1 == names.size()) ? 0 : next+1 ;
+    }) ;
+    Report("lookup_string", "options", n_params, 0, 0, iterations, ns) ;
+}
+
+//__________________________________________________
+void BenchHelp(int n_params, double min_time)
+{
+    CLOptions options ;
+    DefineParams(options, n_params) ;
+    options.AddProgramDescription("Benchmark of the help text rendered by CLOptions.") ;
+    options.AddVersionInfo("cloptions_benchmark") ;
+
+    // Send the help text to /dev/null while timing it
+    std::cout.flush() ;
+    std::fflush(stdout) ;
+    int saved_stdout = ::dup(1) ;
+    int null_fd = ::open("/dev/null", O_WRONLY) ;
+    ::dup2(null_fd, 1) ;
+    // The help text is cached after the first call, so also time rendering
+    // it from scratch (changing the description invalidates the cache)
+    long iterations(0), render_iterations(0) ;
+    double ns = NanosPerOp(min_time, iterations, [&]() {options.PrintHelp("cloptions_benchmark") ;}) ;
+    double render_ns = NanosPerOp(min_time, render_iterations, [&]() {
+        options.AddProgramDescription("Benchmark of the help text rendered by CLOptions.") ;
+        options.PrintHelp("cloptions_benchmark") ;
+    }) ;
+    std::cout.flush() ;
+    std::fflush(stdout) ;
+    ::dup2(saved_stdout, 1) ;
+    ::close(null_fd) ;
+    ::close(saved_stdout) ;
+
+    Report("help", "options", n_params, 0, 0, iterations, ns) ;
+    Report("help_render", "options", n_params, 0, 0, render_iterations, render_ns) ;
+}
+
+//__________________________________________________
+void BenchBatch(int n_params, double min_time)
+{
+    const int n_jobs = 1000 ;
+    std::vector<std::vector<std::string> > jobs(n_jobs) ;
+    for (int i=0; i<n_jobs; i++) {
+        jobs[i].push_back("cloptions_benchmark") ;
+        for (int j=0; j<5; j++) {
+            int par = (i + j*7) % n_params ;
+            jobs[i].push_back("--Param" + std::to_string(par)) ;
+            jobs[i].push_back(ParamValue(par, i)) ;
+        }
+    }
+    
+    // What a job queue would do without the batch parser
+    long iterations(0) ;
+    double ns = NanosPerOp(min_time, iterations, [&]() {
+        for (int i=0; i<n_jobs; i++) {
+            CLOptions options ;
+            DefineParams(options, n_params) ;
+            std::vector<char*> argv ;
+            for (size_t j=0; j<jobs[i].size(); j++) argv.push_back(&jobs[i][j][0]) ;
+            argv.push_back(0) ;
+            options.ParseCommandLine(int(jobs[i].size()), &argv[0]) ;
+        }
+    }) ;
+    Report("batch_fresh", "options", n_params, "threads", 1, iterations, ns / n_jobs) ;
+    
+    CLOptions options ;
+    DefineParams(options, n_params) ;
+    CLBatchParser parser(options) ;
+    ns = NanosPerOp(min_time, iterations, [&]() {parser.Parse(jobs, false) ;}) ;
+    Report("batch", "options", n_params, "threads", parser.GetThreadCount(), iterations, ns / n_jobs) ;
+}
+
+//__________________________________________________
+int main(int argc, char** argv)
+{
+    CLOptions options ;
+    options.AddDoubleParam("MinTime", "Minimum time (in seconds) spent on each measurement.", 0.2) ;
+    options.AddIntParam("MaxOptions", "Largest number of registered options.", 1000) ;
+    options.AddIntParam("MaxTokens", "Largest number of command line tokens.", 1000) ;
+    options.AddIntParam("MaxLines", "Number of lines in the largest config file.", 100000) ;
+    if (options.ParseCommandLine(argc, argv)) return 0 ;
+
+    double min_time = options.AsDouble("MinTime") ;
+
+    for (int n_params=10; n_params<=options.AsInt("MaxOptions"); n_params*=10) {
+        for (int n_tokens=10; n_tokens<=options.AsInt("MaxTokens"); n_tokens*=10) {
+            BenchParse(n_params, n_tokens, min_time) ;
+        }
+    }
+    for (int n_lines=1000; n_lines<=options.AsInt("MaxLines"); n_lines*=10) {
+        BenchFile(100, n_lines, min_time) ;
+    }
+    for (int n_params=10; n_params<=options.AsInt("MaxOptions"); n_params*=10) {
+        BenchLookup(n_params, min_time) ;
+    }
+    for (int n_params=10; n_params<=options.AsInt("MaxOptions"); n_params*=10) {
+        BenchHelp(n_params, min_time) ;
+    }
+    for (int n_params=10; n_params<=options.AsInt("MaxOptions"); n_params*=10) {
+        BenchBatch(n_params, min_time) ;
+    }
+
+    return 0 ;
+}
@@ -0,0 +1,138 @@
+//
+//  configfile_benchmark.cpp
+//  CLOptions
+//
+//  Compile with:
+//      g++ -std=c++11 -O2 -I../include configfile_benchmark.cpp -o configfile_benchmark
+//
+//  Description:
+//      Compares the time taken to fill options from configuration files of
+//      increasing size using the memory mapped loader in CLOptions with the
+//      previous loader (std::getline followed by splitting every line into
+//      a vector of strings through a std::stringstream).
+//
+//  Execute with:
+//      ./configfile_benchmark [--Params 400] [--MaxLines 1000000]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "CLOptions.h"
+
+//__________________________________________________
+// Exposes the protected config file loader
+class BenchOptions : public CLOptions {
+public:
+    bool Fill(const std::string& filename) {return FillFromFile(filename) ;}
+};
+
+//__________________________________________________
+// The loader CLOptions used previously, implemented on the public API
+bool LegacyFillFromFile(CLOptions& options, const std::string& filename)
+{
+    if (!CLOptionsHelper::file_exists(filename)) return true ;
+
+    std::ifstream configFile(filename.c_str()) ;
+    std::string line ;
+    while (std::getline(configFile, line)) {
+        if (line.empty()) continue ;
+        if (line.find("#") == 0) continue ;
+
+        std::vector<std::string> param = CLOptionsHelper::split(line, ' ') ;
+        std::vector<std::string> values(param.begin()+1, param.end()) ;
+        if (values.size() == 0) continue ;
+
+        if (!options.SetParam(param.front(), values)) return false ;
+    }
+    return false ;
+}
+
+//__________________________________________________
+// Register 'n_params' parameters, cycling through the parameter types
+void DefineParams(CLOptions& options, int n_params)
+{
+    // This also sets '#' as the comment marker
+    options.AddConfigFileParam() ;
+    for (int i=0; i<n_params; i++) {
+        std::string name = "Param" + std::to_string(i) ;
+        switch (i % 4) {
+            case 0: options.AddIntParam(name, "Integer parameter", 0) ; break ;
+            case 1: options.AddDoubleParam(name, "Double parameter", 0.0) ; break ;
+            case 2: options.AddBoolParam(name, "Bool parameter", false) ; break ;
+            case 3: options.AddStringParam(name, "String parameter", "") ; break ;
+        }
+    }
+}
+
+//__________________________________________________
+// Write a config file with 'n_lines' lines, including some comments
+void WriteConfig(const std::string& filename, int n_params, int n_lines)
+{
+    std::ofstream config(filename.c_str()) ;
+    for (int i=0; i<n_lines; i++) {
+        if (i % 10 == 0) {
+            config << "# Comment line number " << i << "\n" ;
+            continue ;
+        }
+        int par = i % n_params ;
+        config << "Param" << par << " " ;
+        switch (par % 4) {
+            case 0: config << i ; break ;
+            case 1: config << i * 0.001 ; break ;
+            case 2: config << (i % 2) ; break ;
+            case 3: config << "value_" << i ; break ;
+        }
+        config << "\n" ;
+    }
+}
+
+//__________________________________________________
+template <typename Func>
+double Seconds(Func func)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() ;
+    func() ;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start ;
+    return elapsed.count() ;
+}
+
+//__________________________________________________
+int main(int argc, char** argv)
+{
+    CLOptions options ;
+    options.AddIntParam("Params", "Number of parameters to register.", 400) ;
+    options.AddIntParam("MaxLines", "Number of lines in the largest config file.", 1000000) ;
+    options.AddStringParam("File", "Name of the temporary config file.", "configfile_benchmark.txt") ;
+    if (options.ParseCommandLine(argc, argv)) return 0 ;
+
+    int n_params = options.AsInt("Params") ;
+    const std::string& filename = options.AsString("File") ;
+
+    std::printf("%10s %12s %14s %14s %9s\n", "lines", "bytes", "legacy(s)", "mapped(s)", "speedup") ;
+    for (int n_lines=1000; n_lines<=options.AsInt("MaxLines"); n_lines*=10) {
+        WriteConfig(filename, n_params, n_lines) ;
+
+        BenchOptions legacy ;
+        DefineParams(legacy, n_params) ;
+        double legacy_time = Seconds([&]() {LegacyFillFromFile(legacy, filename) ;}) ;
+
+        BenchOptions mapped ;
+        DefineParams(mapped, n_params) ;
+        double mapped_time = Seconds([&]() {mapped.Fill(filename) ;}) ;
+
+        // Make sure that both loaders read the whole file
+        if (legacy["Param3"] != mapped["Param3"]) {
+            std::printf("Loaders disagree: %s != %s\n", legacy["Param3"].c_str(), mapped["Param3"].c_str()) ;
+            return 1 ;
+        }
+
+        CLOptionsHelper::MappedFile file(filename) ;
+        std::printf("%10d %12zu %14.6f %14.6f %8.1fx\n", n_lines, file.size(),
+                    legacy_time, mapped_time, legacy_time/mapped_time) ;
+    }
+    std::remove(filename.c_str()) ;
+
+    return 0 ;
+}
@@ -0,0 +1,93 @@
+//
+//  conversion_benchmark.cpp
+//  CLOptions
+//
+//  Compile with:
+//      g++ -std=c++11 -O2 -I../include conversion_benchmark.cpp -o conversion_benchmark
+//  or, to use std::from_chars for the doubles:
+//      g++ -std=c++17 -O2 -I../include conversion_benchmark.cpp -o conversion_benchmark
+//
+//  Description:
+//      Measures the number of text to value conversions per second done
+//      when assigning values to CLInt, CLDouble and CLBool parameters,
+//      compared with the std::stringstream based conversion that these
+//      parameters used previously.
+//
+//  Execute with:
+//      ./conversion_benchmark [--Iterations 2000000]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include "CLOptions.h"
+
+//__________________________________________________
+// The conversion previously used by the parameters
+template <typename T>
+void StreamConvert(const std::string& str, T& value)
+{
+    std::stringstream sstream ;
+    sstream << str ;
+    sstream >> value ;
+}
+
+//__________________________________________________
+// Runs 'func' over all of the values 'iterations' times in total and
+// returns the number of conversions per second
+template <typename Func>
+double Rate(const std::vector<std::string>& values, int iterations, Func func)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now() ;
+    for (int i=0; i<iterations; i++) {
+        func(values[i % values.size()]) ;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start ;
+    return iterations / elapsed.count() ;
+}
+
+//__________________________________________________
+void PrintRate(const char* type, double before, double after)
+{
+    std::printf("%-8s %16.0f %16.0f %9.1fx\n", type, before, after, after/before) ;
+}
+
+//__________________________________________________
+int main(int argc, char** argv)
+{
+    CLOptions options ;
+    options.AddIntParam("Iterations", "Number of conversions to time for each type.", 2000000) ;
+    if (options.ParseCommandLine(argc, argv)) return 0 ;
+    int iterations = options.AsInt("Iterations") ;
+
+    std::vector<std::string> ints    = {"0", "42", "-17", "123456", "2147483647", "-99999"} ;
+    std::vector<std::string> doubles = {"0.5", "3.14159", "-2.5e-3", "123456.789", "6.02214076e23", "1"} ;
+    std::vector<std::string> bools   = {"0", "1", "true", "false"} ;
+
+    CLInt    int_par("IntPar", "", 0) ;
+    CLDouble dbl_par("DblPar", "", 0.0) ;
+    CLBool   bool_par("BoolPar", "", false) ;
+
+    // Make sure the compiler cant throw away the conversions
+    volatile double sink = 0 ;
+    int    int_val(0) ;
+    double dbl_val(0) ;
+    bool   bool_val(false) ;
+
+    std::printf("%-8s %16s %16s %10s\n", "type", "stringstream/s", "setFromString/s", "speedup") ;
+
+    double before = Rate(ints, iterations, [&](const std::string& s) {StreamConvert(s, int_val); sink = sink + int_val;}) ;
+    double after  = Rate(ints, iterations, [&](const std::string& s) {int_par.setFromString(s.data(), s.size()); sink = sink + int_par.getValue();}) ;
+    PrintRate("int", before, after) ;
+
+    before = Rate(doubles, iterations, [&](const std::string& s) {StreamConvert(s, dbl_val); sink = sink + dbl_val;}) ;
+    after  = Rate(doubles, iterations, [&](const std::string& s) {dbl_par.setFromString(s.data(), s.size()); sink = sink + dbl_par.getValue();}) ;
+    PrintRate("double", before, after) ;
+
+    // Note that std::stringstream only understands "0" and "1" for bools
+    before = Rate(bools, iterations, [&](const std::string& s) {StreamConvert(s, bool_val); sink = sink + bool_val;}) ;
+    after  = Rate(bools, iterations, [&](const std::string& s) {bool_par.setFromString(s.data(), s.size()); sink = sink + bool_par.getValue();}) ;
+    PrintRate("bool", before, after) ;
+
+    return 0 ;
+}
@@ -0,0 +1,64 @@
+//
+//  batch_example.cpp
+//  CLOptions
+//
+//  Compile with:
+//      g++ -std=c++11 -pthread -I../include batch_example.cpp -o batch_example
+//
+//  Description:
+//      Demonstrates checking many command lines at once, as a job queue
+//      would before submitting the jobs. Each line of the jobs file is one
+//      command line, which is parsed against the options of the program
+//      that will run it. The jobs are spread over all of the cores.
+//
+//  Execute with:
+//      ./batch_example --JobsFile batch_example_jobs.txt
+//
+
+#include <fstream>
+#include <iostream>
+#include "CLOptionsBatch.h"
+
+//__________________________________________________
+// Options of the program that runs the jobs
+CLOptions DefineJobOptions()
+{
+    CLOptions options ;
+    options.AddIntParam("n,Events", "Number of events to generate.", 1000) ;
+    options.AddDoubleParam("Energy", "Beam energy (in GeV).", 13.6) ;
+    options.AddStringParam("Output", "Name of the output file.", "output.root") ;
+    return options ;
+}
+
+//__________________________________________________
+int main(int argc, char** argv)
+{
+    CLOptions options ;
+    options.AddStringParam("JobsFile", "File with one command line per job.", "batch_example_jobs.txt") ;
+    options.AddIntParam("Threads", "Number of threads (0 uses all of the cores).", 0) ;
+    if (options.ParseCommandLine(argc, argv)) return 0 ;
+
+    // Split every line of the file into the arguments of one job
+    std::vector<std::vector<std::string> > jobs ;
+    std::ifstream jobs_file(options.AsString("JobsFile").c_str()) ;
+    std::string line ;
+    while (std::getline(jobs_file, line)) {
+        if (line.empty() || (line[0] == '#')) continue ;
+        jobs.push_back(CLOptionsHelper::split(line, ' ')) ;
+    }
+
+    CLBatchParser parser(DefineJobOptions(), options.AsInt("Threads")) ;
+    std::vector<CLBatchResult> results = parser.Parse(jobs) ;
+
+    for (size_t i=0; i<results.size(); i++) {
+        if (results[i].error) {
+            std::cout << "Job " << i << " is invalid:\n" << results[i].messages ;
+        } else {
+            std::cout << "Job " << i << ": " << results[i].values.AsInt("Events") << " events at "
+                      << results[i].values.AsDouble("Energy") << " GeV into "
+                      << results[i].values.AsString("Output") << std::endl;
+        }
+    }
+
+    return 0 ;
+}
@@ -0,0 +1,50 @@
+//
+//  bind_example.cpp
+//  CLOptions
+//
+//  Compile with:
+//      g++ -std=c++11 -I../include bind_example.cpp -o bind_example
+//
+//  Description:
+//      Demonstrates binding command line options directly to the members
+//      of a configuration struct, so that no values need to be copied out
+//      of the CLOptions object after the command line has been parsed.
+//
+//  Execute with:
+//      ./bind_example --Threads 8 --Tolerance 1.0e-9 --Output results.txt
+//
+
+#include <iostream>
+#include "CLOptions.h"
+
+// Configuration used by the rest of the program
+struct Config {
+    int         n_threads = 1 ;
+    double      tolerance = 1.0e-6 ;
+    bool        verbose   = false ;
+    std::string output    = "output.txt" ;
+} ;
+
+int main(int argc, char** argv)
+{
+    Config config ;
+
+    // The current values of the struct members are used as the defaults
+    CLOptions options ;
+    options.BindIntParam("t,Threads", "Number of worker threads.", config.n_threads) ;
+    options.BindDoubleParam("Tolerance", "Convergence tolerance.", config.tolerance) ;
+    options.BindBoolParam("Verbose", "Print extra information.", config.verbose) ;
+    options.BindStringParam("o,Output", "Name of the output file.", config.output) ;
+
+    // Parsing the command line fills the struct directly
+    if (options.ParseCommandLine(argc, argv)) {
+        return 0 ;
+    }
+
+    std::cout << "Threads  : " << config.n_threads << std::endl;
+    std::cout << "Tolerance: " << config.tolerance << std::endl;
+    std::cout << "Verbose  : " << config.verbose << std::endl;
+    std::cout << "Output   : " << config.output << std::endl;
+
+    return 0 ;
+}
@@ -0,0 +1,70 @@
+//
+//  hotreload_example.cpp
+//  CLOptions
+//
+//  Compile with:
+//      g++ -std=c++11 -pthread -I../include hotreload_example.cpp -o hotreload_example
+//
+//  Description:
+//      Demonstrates reloading the options of a running program whenever its
+//      configuration file changes. Worker threads keep reading the options
+//      while they're being replaced, without taking any locks.
+//
+//  Execute with:
+//      ./hotreload_example --ConfigFile configfile_example.txt
+//  and edit 'configfile_example.txt' while the program is running.
+//
+
+#include <iostream>
+#include "CLOptionsWatcher.h"
+
+//__________________________________________________
+CLOptions DefineOptions()
+{
+    CLOptions options ;
+    options.AddConfigFileParam("", "", "configfile_example.txt") ;
+    options.AddDoubleParam("Pi", "An very inaccurate value of Pi!", 3.14) ;
+    options.AddBoolParam("ILikePi", "Do you like pi?", true) ;
+    options.AddIntParam("Seconds", "How long to keep running.", 30) ;
+    return options ;
+}
+
+//__________________________________________________
+int main(int argc, char** argv)
+{
+    CLConfigWatcher watcher(DefineOptions(), argc, argv) ;
+    if (watcher.Start()) return 1 ;
+    std::cout << "Watching " << watcher.GetFileName() << std::endl;
+
+    // The workers just keep reading the current value of Pi
+    std::atomic<bool> done(false) ;
+    std::vector<std::thread> workers ;
+    for (int i=0; i<4; i++) {
+        workers.push_back(std::thread([&]() {
+            double sum = 0 ;
+            while (!done.load()) {
+                CLConfigWatcher::Reader options = watcher.Read() ;
+                sum += options->AsDouble("Pi") ;
+            }
+        })) ;
+    }
+
+    // Report whenever the options change
+    unsigned long generation = 0 ;
+    int seconds = watcher.Read()->AsInt("Seconds") ;
+    for (int i=0; i<seconds*10; i++) {
+        if (watcher.Generation() != generation) {
+            generation = watcher.Generation() ;
+            CLConfigWatcher::Reader options = watcher.Read() ;
+            std::cout << "Generation " << generation << ": Pi = " << options->AsDouble("Pi")
+                      << ", ILikePi = " << options->AsBool("ILikePi") << std::endl;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100)) ;
+    }
+
+    done = true ;
+    for (size_t i=0; i<workers.size(); i++) workers[i].join() ;
+    watcher.Stop() ;
+
+    return 0 ;
+}
@@ -0,0 +1,70 @@
+//
+//  subcommand_example.cpp
+//  CLOptions
+//
+//  Compile with:
+//      g++ -std=c++11 -I../include subcommand_example.cpp -o subcommand_example
+//
+//  Description:
+//      Demonstrates a program with git-style subcommands. The options of
+//      each subcommand are only added when that subcommand is used, so the
+//      program doesnt have to define the options of all of its subcommands
+//      every time it runs.
+//
+//  Execute with:
+//      ./subcommand_example -h
+//      ./subcommand_example build -h
+//      ./subcommand_example --Verbose 1 build --Jobs 8 --Target release
+//      ./subcommand_example clean --All 1
+//
+
+#include <iostream>
+#include "CLOptions.h"
+
+//__________________________________________________
+void DefineBuildOptions(CLOptions& options)
+{
+    options.AddIntParam("j,Jobs", "Number of parallel jobs.", 1) ;
+    options.AddStringParam("Target", "Name of the target to build.", "debug") ;
+}
+
+//__________________________________________________
+void DefineCleanOptions(CLOptions& options)
+{
+    options.AddBoolParam("All", "Also remove the downloaded dependencies.", false) ;
+}
+
+//__________________________________________________
+CLOptions DefineOptions()
+{
+    CLOptions options ;
+    options.AddProgramDescription("Example of a program with subcommands.") ;
+
+    // Options shared by all of the subcommands
+    options.AddBoolParam("Verbose", "Print extra information.", false) ;
+
+    // The subcommands and the functions adding their options
+    options.AddSubcommand("build", "Build the project.", DefineBuildOptions) ;
+    options.AddSubcommand("clean", "Remove the build products.", DefineCleanOptions) ;
+
+    return options ;
+}
+
+//__________________________________________________
+int main(int argc, char** argv)
+{
+    CLOptions options = DefineOptions() ;
+    if (options.ParseCommandLine(argc, argv)) return 0 ;
+
+    if (options.GetSubcommand() == "build") {
+        std::cout << "Building " << options.AsString("Target")
+                  << " with " << options.AsInt("Jobs") << " jobs" << std::endl;
+    } else if (options.GetSubcommand() == "clean") {
+        std::cout << "Cleaning" << (options.AsBool("All") ? " everything" : "") << std::endl;
+    } else {
+        std::cout << "No command given, see '" << argv[0] << " -h'" << std::endl;
+    }
+    if (options.AsBool("Verbose")) options.PrintSimple() ;
+
+    return 0 ;
+}
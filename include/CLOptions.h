@@ -32,6 +32,17 @@
 //       std::string str1 = options.AsString("DblParam") ; // BAD, will produce error msg
 //       std::string str2 = options["DblParam"] ;          // GOOD, will put "DblParam" value into a string
 //
+//  - Each of the 'Add*Param' methods returns a 'CLHandle' which
+//    can be used to read the value of that parameter without
+//    looking it up by name. For example:
+//
+//       CLHandle<double> dbl_par = options.AddDoubleParam("DblParam","Generic double parameter", 123.456) ;
+//       double dbl = dbl_par ;                              // GOOD, no lookup required
+//
+//  - Once the command line has been parsed, 'Freeze()' returns an
+//    immutable copy of the values with the same 'As*' accessors,
+//    which can be shared by reference between threads.
+//
 // (legal stuff)
 //
 // The original author releases this code with the under-
@@ -41,22 +52,94 @@
 #ifndef CLOptions_h
 #define CLOptions_h
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <chrono>
 #include <iostream>
 #include <fstream>
-#include <getopt.h>
+#include <functional>
+#include <fcntl.h>
+#include <getopt.h>     // Only used for the definition of "struct option"
+#include <locale.h>
 #include <map>
+#include <new>
 #include <sstream>
 #include <string>
+#include <strings.h>    // strncasecmp
+#include <utility>
 #include <vector>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The environment of the process (not declared by every system header)
+extern char** environ ;
+
+// Use std::from_chars for floating point conversions when it is available
+#if defined(__has_include)
+#if __has_include(<charconv>) && (__cplusplus >= 201703L)
+#include <charconv>
+#endif
+#endif
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L)
+#define CLOPT_USE_FROM_CHARS
+#elif defined(__APPLE__)
+#include <xlocale.h>    // strtod_l
+#endif
 
 // Some defines when printing parameter descriptions
 #define CLOPT_MAX_DESCRIPTION_WIDTH 80    // Controls the maximum # of characters to print in description
 #define CLOPT_PAD_DESCRIPTION_WIDTH 15    // Controls how many spaces are printed before each line of the description
 
+// Size of the blocks of memory used to store the parameter objects
+#ifndef CLOPT_ARENA_BLOCK_SIZE
+#define CLOPT_ARENA_BLOCK_SIZE 8192
+#endif
+
+// Define CLOPT_ENABLE_STATS before including this header to collect the
+// timing statistics returned by 'CLOptions::GetParseStats()'. Otherwise
+// the instrumentation is compiled out completely.
+#ifdef CLOPT_ENABLE_STATS
+#define CLOPT_STATS_RESET()             (parse_stats_ = CLParseStats())
+#define CLOPT_STATS_CONCAT2(a, b)       a##b
+#define CLOPT_STATS_CONCAT(a, b)        CLOPT_STATS_CONCAT2(a, b)
+#define CLOPT_STATS_SCOPE(field)        CLParseStats::Timer CLOPT_STATS_CONCAT(clopt_stats_timer_, __LINE__)(parse_stats_.field)
+#define CLOPT_STATS_START(timer)        CLParseStats::Clock::time_point timer = CLParseStats::Clock::now()
+#define CLOPT_STATS_STOP(timer, field)  (parse_stats_.field += CLParseStats::Since(timer))
+#define CLOPT_STATS_ADD(field, n)       (parse_stats_.field += (n))
+#else
+#define CLOPT_STATS_RESET()             ((void)0)
+#define CLOPT_STATS_SCOPE(field)
+#define CLOPT_STATS_START(timer)
+#define CLOPT_STATS_STOP(timer, field)  ((void)0)
+#define CLOPT_STATS_ADD(field, n)       ((void)0)
+#endif
+
+// Define CLOPT_ENABLE_PROFILING before including this header to count how
+// often each parameter is looked up by name (see 'PrintAccessReport()')
+#ifdef CLOPT_ENABLE_PROFILING
+#include <atomic>
+#define CLOPT_PROFILE_ACCESS(entry) do { if ((entry) != 0) (entry)->param->countAccess() ; } while (0)
+#else
+#define CLOPT_PROFILE_ACCESS(entry) ((void)0)
+#endif
+
 // This parameter prevents the case where 'max_descriptoin_width' < 'pad_description_width'
 #define CLOPT_MAX_WIDTH ((CLOPT_MAX_DESCRIPTION_WIDTH>CLOPT_PAD_DESCRIPTION_WIDTH) ? CLOPT_MAX_DESCRIPTION_WIDTH : CLOPT_PAD_DESCRIPTION_WIDTH + 1)
 
-//enum CLParamType {BOOL, DOUBLE, INT, STRING} ;
+// Result of converting the text passed for a parameter into its value
+enum CLConvertStatus {CL_CONVERT_OK,        // Conversion succeeded
+                      CL_CONVERT_INVALID,   // Text does not start with a valid value
+                      CL_CONVERT_PARTIAL,   // Text has trailing characters after the value
+                      CL_CONVERT_RANGE} ;   // Value does not fit in the parameter type
 
 namespace CLOptionsHelper {
     /***************************************
@@ -78,96 +161,1090 @@ namespace CLOptionsHelper {
         return elems;
     }
     
+    /***************************************
+     * Methods for converting text into parameter values. These dont
+     * allocate memory or depend on the locale, and only modify 'out'
+     * if the conversion succeeds.
+     ***************************************/
+#ifndef CLOPT_USE_FROM_CHARS
+    // Length of the longest prefix of 'str' that std::from_chars would
+    // read as a floating point number (0 if there isnt one): an optional
+    // sign, then decimal digits with an optional '.' and exponent, or
+    // "inf", "infinity", "nan" or "nan(chars)" in any case
+    inline size_t scan_double(const char* str, size_t len)
+    {
+        size_t i = 0 ;
+        if ((len > 0) && ((str[0] == '-') || (str[0] == '+'))) i++ ;
+        
+        // Infinity and NaN
+        if ((len - i >= 3) && (strncasecmp(str+i, "inf", 3) == 0)) {
+            return ((len - i >= 8) && (strncasecmp(str+i, "infinity", 8) == 0)) ? i+8 : i+3 ;
+        }
+        if ((len - i >= 3) && (strncasecmp(str+i, "nan", 3) == 0)) {
+            size_t j = i+3 ;
+            if ((j < len) && (str[j] == '(')) {
+                for (j++; (j < len) && (std::isalnum((unsigned char)str[j]) || (str[j] == '_')); j++) {}
+                if ((j < len) && (str[j] == ')')) return j+1 ;
+            }
+            return i+3 ;
+        }
+        
+        // Digits with an optional decimal point (but at least one digit)
+        size_t n_digits = 0 ;
+        for (; (i < len) && (str[i] >= '0') && (str[i] <= '9'); i++) n_digits++ ;
+        if ((i < len) && (str[i] == '.')) {
+            for (i++; (i < len) && (str[i] >= '0') && (str[i] <= '9'); i++) n_digits++ ;
+        }
+        if (n_digits == 0) return 0 ;
+        
+        // The exponent is only part of the number if it has digits
+        if ((i < len) && ((str[i] == 'e') || (str[i] == 'E'))) {
+            size_t j = i+1 ;
+            if ((j < len) && ((str[j] == '-') || (str[j] == '+'))) j++ ;
+            if ((j < len) && (str[j] >= '0') && (str[j] <= '9')) {
+                for (i = j; (i < len) && (str[i] >= '0') && (str[i] <= '9'); i++) {}
+            }
+        }
+        return i ;
+    }
+    
+    // The "C" locale, so that 'strtod_l' always expects a '.'
+    inline locale_t c_locale()
+    {
+        static locale_t locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0) ;
+        return locale ;
+    }
+#endif
+    inline CLConvertStatus convert(const char* str, size_t len, int& out)
+    {
+        size_t i = 0 ;
+        bool negative = (len > 0) && (str[0] == '-') ;
+        if ((len > 0) && ((str[0] == '-') || (str[0] == '+'))) i++ ;
+        if ((i == len) || (str[i] < '0') || (str[i] > '9')) return CL_CONVERT_INVALID ;
+        
+        // Accumulate the digits, checking for overflow as we go
+        unsigned long long limit = negative ? (unsigned long long)INT_MAX + 1 : INT_MAX ;
+        unsigned long long val = 0 ;
+        for (; (i < len) && (str[i] >= '0') && (str[i] <= '9'); i++) {
+            val = 10*val + (str[i] - '0') ;
+            if (val > limit) return CL_CONVERT_RANGE ;
+        }
+        if (i != len) return CL_CONVERT_PARTIAL ;
+        
+        out = negative ? int(-(long long)val) : int(val) ;
+        return CL_CONVERT_OK ;
+    }
+    inline CLConvertStatus convert(const char* str, size_t len, double& out)
+    {
+        // Leading white space isnt part of a value
+        if ((len == 0) || std::isspace((unsigned char)str[0])) return CL_CONVERT_INVALID ;
+        double val(0) ;
+#ifdef CLOPT_USE_FROM_CHARS
+        // std::from_chars doesnt accept a leading '+' (but only skip it if it
+        // isnt followed by another sign, which strtod wouldnt accept either)
+        bool plus = (str[0] == '+') && ((len == 1) || ((str[1] != '-') && (str[1] != '+'))) ;
+        const char* begin = plus ? str+1 : str ;
+        std::from_chars_result result = std::from_chars(begin, str+len, val) ;
+        if (result.ec == std::errc::invalid_argument) return CL_CONVERT_INVALID ;
+        if (result.ec == std::errc::result_out_of_range) return CL_CONVERT_RANGE ;
+        if (result.ptr != str+len) return CL_CONVERT_PARTIAL ;
+#else
+        // Only give strtod the text std::from_chars would read, so that
+        // both accept the same values (strtod also reads hexadecimal)
+        size_t n = scan_double(str, len) ;
+        if (n == 0) return CL_CONVERT_INVALID ;
+        
+        // strtod requires a null terminated string, so copy short values
+        // into a local buffer (values that dont fit are rare)
+        char buffer[64] ;
+        std::string long_str ;
+        const char* cstr = buffer ;
+        if (n < sizeof(buffer)) {
+            std::memcpy(buffer, str, n) ;
+            buffer[n] = '\0' ;
+        } else {
+            long_str.assign(str, n) ;
+            cstr = long_str.c_str() ;
+        }
+        errno = 0 ;
+        val = strtod_l(cstr, 0, c_locale()) ;
+        // Like std::from_chars, only reject values too large or too small
+        // to be anything but infinity or zero (subnormal values are fine)
+        if ((errno == ERANGE) && ((val == 0) || (val == HUGE_VAL) || (val == -HUGE_VAL))) return CL_CONVERT_RANGE ;
+        if (n != len) return CL_CONVERT_PARTIAL ;
+#endif
+        out = val ;
+        return CL_CONVERT_OK ;
+    }
+    inline CLConvertStatus convert(const char* str, size_t len, bool& out)
+    {
+        if ((len == 1) && ((str[0] == '0') || (str[0] == '1'))) {
+            out = (str[0] == '1') ;
+        } else if ((len == 4) && (std::memcmp(str, "true", 4) == 0)) {
+            out = true ;
+        } else if ((len == 5) && (std::memcmp(str, "false", 5) == 0)) {
+            out = false ;
+        } else {
+            return CL_CONVERT_INVALID ;
+        }
+        return CL_CONVERT_OK ;
+    }
+    inline CLConvertStatus convert(const char* str, size_t len, std::string& out)
+    {
+        out.assign(str, len) ;
+        return CL_CONVERT_OK ;
+    }
+    
+    /***************************************
+     * Methods for rendering values as text (matching the output of
+     * std::ostream's operator<<)
+     ***************************************/
+    inline void to_string(int val, std::string& out)
+    {
+        char buffer[16] ;
+        out.assign(buffer, std::snprintf(buffer, sizeof(buffer), "%d", val)) ;
+    }
+    inline void to_string(double val, std::string& out)
+    {
+        char buffer[32] ;
+        out.assign(buffer, std::snprintf(buffer, sizeof(buffer), "%g", val)) ;
+    }
+    inline void to_string(bool val, std::string& out)
+    {
+        out.assign(val ? "1" : "0", 1) ;
+    }
+    inline void to_string(const std::string& val, std::string& out)
+    {
+        out = val ;
+    }
+    
+    /***************************************
+     * Methods for handling lists of values
+     ***************************************/
+    // Characters that separate the values in a list
+    inline bool is_list_delim(char c)
+    {
+        return (c == ',') || (c == ' ') || (c == '\t') ;
+    }
+    
+    // Find the next list delimiter in [str,end), or 'end' if there is none.
+    // This checks 8 characters at a time by testing for a zero byte in the
+    // word XOR'ed with each delimiter.
+    inline const char* find_list_delim(const char* str, const char* end)
+    {
+        const unsigned long long ones  = 0x0101010101010101ULL ;
+        const unsigned long long highs = 0x8080808080808080ULL ;
+        for (; str + 8 <= end; str += 8) {
+            unsigned long long word ;
+            std::memcpy(&word, str, 8) ;
+            unsigned long long comma = word ^ (ones * ',') ;
+            unsigned long long space = word ^ (ones * ' ') ;
+            unsigned long long tab   = word ^ (ones * '\t') ;
+            if ((((comma - ones) & ~comma) | ((space - ones) & ~space) | ((tab - ones) & ~tab)) & highs) break ;
+        }
+        for (; str < end; str++) {
+            if (is_list_delim(*str)) return str ;
+        }
+        return end ;
+    }
+    
+    // Convert a comma or white space separated list of values. Empty
+    // values (e.g. from "1, 2") are skipped.
+    template <typename T>
+    inline CLConvertStatus convert(const char* str, size_t len, std::vector<T>& out)
+    {
+        const char* end = str + len ;
+        
+        // Count the delimiters first so that the values can be stored
+        // without reallocating
+        size_t max_values = 1 ;
+        for (const char* c = find_list_delim(str, end); c != end; c = find_list_delim(c+1, end)) {
+            max_values++ ;
+        }
+        std::vector<T> values ;
+        values.reserve(max_values) ;
+        
+        while (str < end) {
+            const char* delim = find_list_delim(str, end) ;
+            if (delim != str) {
+                values.push_back(T()) ;
+                CLConvertStatus status = convert(str, delim - str, values.back()) ;
+                if (status != CL_CONVERT_OK) return status ;
+            }
+            str = delim + 1 ;
+        }
+        out.swap(values) ;
+        return CL_CONVERT_OK ;
+    }
+    
+    // Render a list as comma separated values
+    template <typename T>
+    inline void to_string(const std::vector<T>& val, std::string& out)
+    {
+        out.clear() ;
+        std::string item ;
+        for (size_t i=0; i<val.size(); i++) {
+            if (i > 0) out += ',' ;
+            to_string(val[i], item) ;
+            out += item ;
+        }
+    }
+    
+    /***************************************
+     * Methods for storing values in binary snapshots (see
+     * CLOptions::SaveSnapshot). Values are stored in the native byte
+     * order, and 'from_binary' only modifies 'out' if 'size' is valid.
+     * 'check_binary' tells whether 'from_binary' would accept the data
+     * for a value of the same type as 'val', without reading it.
+     ***************************************/
+    template <typename T>
+    inline void to_binary(const T& val, std::string& out)
+    {
+        out.append(reinterpret_cast<const char*>(&val), sizeof(T)) ;
+    }
+    template <typename T>
+    inline bool check_binary(const char*, size_t size, const T&)
+    {
+        return (size == sizeof(T)) ;
+    }
+    template <typename T>
+    inline bool from_binary(const char* data, size_t size, T& out)
+    {
+        if (!check_binary(data, size, out)) return false ;
+        std::memcpy(&out, data, sizeof(T)) ;
+        return true ;
+    }
+    inline void to_binary(bool val, std::string& out)
+    {
+        out += char(val ? 1 : 0) ;
+    }
+    inline bool check_binary(const char*, size_t size, bool)
+    {
+        return (size == 1) ;
+    }
+    inline bool from_binary(const char* data, size_t size, bool& out)
+    {
+        if (!check_binary(data, size, out)) return false ;
+        out = (data[0] != 0) ;
+        return true ;
+    }
+    inline void to_binary(const std::string& val, std::string& out)
+    {
+        out += val ;
+    }
+    inline bool check_binary(const char*, size_t, const std::string&)
+    {
+        return true ;
+    }
+    inline bool from_binary(const char* data, size_t size, std::string& out)
+    {
+        out.assign(data, size) ;
+        return true ;
+    }
+    // Lists of numbers are stored as a plain array of values
+    template <typename T>
+    inline void to_binary(const std::vector<T>& val, std::string& out)
+    {
+        if (!val.empty()) out.append(reinterpret_cast<const char*>(&val[0]), val.size()*sizeof(T)) ;
+    }
+    template <typename T>
+    inline bool check_binary(const char*, size_t size, const std::vector<T>&)
+    {
+        return (size % sizeof(T) == 0) ;
+    }
+    template <typename T>
+    inline bool from_binary(const char* data, size_t size, std::vector<T>& out)
+    {
+        if (!check_binary(data, size, out)) return false ;
+        out.resize(size / sizeof(T)) ;
+        if (size > 0) std::memcpy(&out[0], data, size) ;
+        return true ;
+    }
+    // Lists of strings are stored as a 32 bit length followed by the characters
+    inline void to_binary(const std::vector<std::string>& val, std::string& out)
+    {
+        for (size_t i=0; i<val.size(); i++) {
+            to_binary(uint32_t(val[i].size()), out) ;
+            out += val[i] ;
+        }
+    }
+    inline bool check_binary(const char* data, size_t size, const std::vector<std::string>&)
+    {
+        const char* end = data + size ;
+        while (data < end) {
+            uint32_t len ;
+            if ((end - data < 4) || !from_binary(data, 4, len) || (size_t(end - data - 4) < len)) return false ;
+            data += 4 + len ;
+        }
+        return true ;
+    }
+    inline bool from_binary(const char* data, size_t size, std::vector<std::string>& out)
+    {
+        std::vector<std::string> values ;
+        const char* end = data + size ;
+        while (data < end) {
+            uint32_t len ;
+            if ((end - data < 4) || !from_binary(data, 4, len) || (size_t(end - data - 4) < len)) return false ;
+            values.push_back(std::string(data + 4, len)) ;
+            data += 4 + len ;
+        }
+        out.swap(values) ;
+        return true ;
+    }
+    
+    // Empty string returned by reference when a parameter doesnt exist
+    inline const std::string& empty_string()
+    {
+        static const std::string empty ;
+        return empty ;
+    }
+    
+    // Describes why a conversion failed
+    inline const char* convert_error(CLConvertStatus status)
+    {
+        switch (status) {
+            case CL_CONVERT_INVALID: return "not a valid value" ;
+            case CL_CONVERT_PARTIAL: return "unexpected characters after the value" ;
+            case CL_CONVERT_RANGE:   return "value out of range" ;
+            default:                 return "no error" ;
+        }
+    }
+    
+    // Messages (errors and the help text) are printed to the terminal,
+    // unless a 'MessageCapture' exists in the current thread, in which
+    // case they're written to its stream instead
+    inline std::ostream*& message_capture()
+    {
+        static thread_local std::ostream* capture = 0 ;
+        return capture ;
+    }
+    inline std::ostream& errors(std::ostream& fallback = std::cerr)
+    {
+        std::ostream* capture = message_capture() ;
+        return (capture != 0) ? *capture : fallback ;
+    }
+    
+    /***************************************
+     * Sends the messages printed by CLOptions in the current thread to
+     * 'stream' for as long as the object exists
+     ***************************************/
+    class MessageCapture {
+    public:
+        explicit MessageCapture(std::ostream& stream) : previous_(message_capture())
+        {message_capture() = &stream ;}
+        ~MessageCapture() {message_capture() = previous_ ;}
+        MessageCapture(const MessageCapture&) = delete ;
+        MessageCapture& operator=(const MessageCapture&) = delete ;
+    private:
+        std::ostream* previous_ ;
+    };
+    
     // Tests whether a file is accessible
     static inline bool file_exists (const std::string& name, bool hard_check=true) {
         std::ifstream f( name.c_str() );
         if ( !f.good() && hard_check ) {
             // note that the name is put in quotes to show when
             // extra white space has been added
-            std::cout << "[ERROR] File does not exist:\n   \"" << name << "\"" << std::endl;
+            errors(std::cout) << "[ERROR] File does not exist:\n   \"" << name << "\"" << std::endl;
         }
         return f.good();
     }
+    
+    /***************************************
+     * Read-only view of the contents of a file. The file is memory mapped
+     * where possible (falling back to reading it into memory otherwise),
+     * so large files can be scanned without copying them line by line.
+     ***************************************/
+    class MappedFile {
+    public:
+        MappedFile() : data_(0), size_(0), mapped_(false) {}
+        explicit MappedFile(const std::string& filename, bool allow_map = true) :
+            data_(0), size_(0), mapped_(false)
+        {Open(filename, allow_map) ;}
+        MappedFile(const MappedFile& other) = delete ;
+        MappedFile& operator=(const MappedFile& other) = delete ;
+        virtual ~MappedFile() {Close() ;}
+        
+        // Returns false if the file couldnt be opened. Note that reading a
+        // mapped file raises SIGBUS if the file is truncated in the meantime,
+        // so files which may change while they're read shouldnt be mapped.
+        bool Open(const std::string& filename, bool allow_map = true)
+        {
+            Close() ;
+            int fd = ::open(filename.c_str(), O_RDONLY) ;
+            if (fd < 0) return false ;
+            
+            struct stat info ;
+            if (allow_map && (::fstat(fd, &info) == 0) && S_ISREG(info.st_mode)) {
+                size_ = info.st_size ;
+                if (size_ == 0) {
+                    ::close(fd) ;
+                    data_ = "" ;
+                    return true ;
+                }
+                void* addr = ::mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0) ;
+                if (addr != MAP_FAILED) {
+                    data_   = static_cast<const char*>(addr) ;
+                    mapped_ = true ;
+                    ::close(fd) ;
+                    return true ;
+                }
+            }
+            
+            // Fall back to reading the whole file (e.g. for pipes)
+            char buffer[65536] ;
+            ssize_t n_read ;
+            while (((n_read = ::read(fd, buffer, sizeof(buffer))) > 0) ||
+                   ((n_read < 0) && (errno == EINTR))) {
+                if (n_read > 0) contents_.append(buffer, n_read) ;
+            }
+            ::close(fd) ;
+            
+            // Dont leave anything behind if the file couldnt be read (e.g.
+            // it's a directory), so that 'is_open' is false
+            if (n_read < 0) {
+                Close() ;
+                return false ;
+            }
+            data_ = contents_.data() ;
+            size_ = contents_.size() ;
+            return true ;
+        }
+        
+        void Close()
+        {
+            if (mapped_) ::munmap(const_cast<char*>(data_), size_) ;
+            contents_.clear() ;
+            data_   = 0 ;
+            size_   = 0 ;
+            mapped_ = false ;
+        }
+        
+        bool        is_open() const {return data_ != 0 ;}
+        const char* data() const {return data_ ;}
+        size_t      size() const {return size_ ;}
+    protected:
+        const char* data_ ;
+        size_t      size_ ;
+        bool        mapped_ ;
+        std::string contents_ ;     // Only used when the file cant be mapped
+    private:
+    };
+    
+    /***************************************
+     * Methods for writing to the terminal
+     ***************************************/
+    // Maximum length of a line of help text. This is the width of the
+    // terminal when printing to one, then the COLUMNS environment variable,
+    // and otherwise CLOPT_MAX_DESCRIPTION_WIDTH.
+    inline size_t terminal_width()
+    {
+        size_t columns(0) ;
+        struct winsize window ;
+        if (::isatty(STDOUT_FILENO) && (::ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0)) {
+            columns = window.ws_col ;
+        }
+        if (columns == 0) {
+            const char* columns_env = std::getenv("COLUMNS") ;
+            if (columns_env != 0) columns = std::strtoul(columns_env, 0, 10) ;
+        }
+        // Leave room for the space printed after the last word on a line
+        size_t width = (columns > 1) ? columns - 1 : CLOPT_MAX_WIDTH ;
+        return std::max(width, size_t(CLOPT_PAD_DESCRIPTION_WIDTH + 1)) ;
+    }
+    
+    // Write all of 'data' to a file descriptor
+    inline bool write_all(int fd, const char* data, size_t size)
+    {
+        while (size > 0) {
+            ssize_t n_written = ::write(fd, data, size) ;
+            if (n_written < 0) {
+                if (errno == EINTR) continue ;
+                return false ;
+            }
+            data += n_written ;
+            size -= n_written ;
+        }
+        return true ;
+    }
+
+    /***************************************
+     * Finds the name closest to a misspelt one, for "did you mean"
+     * suggestions. The Levenshtein distance (ignoring case) is computed
+     * with the bit-parallel algorithm of Myers (1999), which compares the
+     * misspelt name with each candidate in a single pass over the
+     * candidate, so that thousands of names can be checked quickly.
+     * Names longer than 64 characters use the usual dynamic programming.
+     ***************************************/
+    class Suggestion {
+    public:
+        Suggestion(const char* name, size_t name_len) :
+            name_(name, name_len),
+            max_distance_(std::max<size_t>(2, name_len/3)),
+            best_distance_(size_t(-1))
+        {
+            // Dont suggest names which have nothing in common with this one
+            if (max_distance_ >= name_len) max_distance_ = (name_len > 0) ? name_len-1 : 0 ;
+            
+            // Bit i of 'peq_[c]' is set if character i of the name is 'c'
+            std::fill(peq_, peq_ + 256, uint64_t(0)) ;
+            for (size_t i=0; (i<name_len) && (i<64); i++) {
+                peq_[Fold(name[i])] |= uint64_t(1) << i ;
+            }
+        }
+        
+        // Consider 'candidate' as a suggestion
+        void Check(const std::string& candidate)
+        {
+            size_t len_diff = (candidate.size() > name_.size()) ? candidate.size() - name_.size() :
+                                                                  name_.size() - candidate.size() ;
+            if ((len_diff > max_distance_) || (len_diff >= best_distance_)) return ;
+            
+            size_t distance = (name_.size() <= 64) ? Distance(candidate) : SlowDistance(candidate) ;
+            if ((distance <= max_distance_) && (distance < best_distance_)) {
+                best_distance_ = distance ;
+                best_ = candidate ;
+            }
+        }
+        
+        // The closest name found (empty if none was close enough)
+        const std::string& Best() const {return best_ ;}
+    
+    protected:
+        static unsigned char Fold(char c) {return (unsigned char)std::tolower((unsigned char)c) ;}
+        
+        // Myers' algorithm, tracking the last row of the distance matrix
+        // through the vertical (Pv/Mv) and horizontal (Ph/Mh) differences
+        size_t Distance(const std::string& text) const
+        {
+            size_t m = name_.size() ;
+            if (m == 0) return text.size() ;
+            uint64_t last = uint64_t(1) << (m-1) ;
+            uint64_t pv = ~uint64_t(0), mv = 0 ;
+            size_t score = m ;
+            for (size_t j=0; j<text.size(); j++) {
+                uint64_t eq = peq_[Fold(text[j])] ;
+                uint64_t xv = eq | mv ;
+                uint64_t xh = (((eq & pv) + pv) ^ pv) | eq ;
+                uint64_t ph = mv | ~(xh | pv) ;
+                uint64_t mh = pv & xh ;
+                if (ph & last) {
+                    score++ ;
+                } else if (mh & last) {
+                    score-- ;
+                }
+                // The first row grows by one with every character of 'text'
+                ph = (ph << 1) | 1 ;
+                mh = mh << 1 ;
+                pv = mh | ~(xv | ph) ;
+                mv = ph & xv ;
+            }
+            return score ;
+        }
+        
+        size_t SlowDistance(const std::string& text) const
+        {
+            std::vector<size_t> row(text.size()+1) ;
+            for (size_t j=0; j<=text.size(); j++) row[j] = j ;
+            for (size_t i=1; i<=name_.size(); i++) {
+                size_t diagonal = row[0] ;
+                row[0] = i ;
+                for (size_t j=1; j<=text.size(); j++) {
+                    size_t above = row[j] ;
+                    size_t cost = (Fold(name_[i-1]) == Fold(text[j-1])) ? 0 : 1 ;
+                    row[j] = std::min(std::min(row[j-1], above) + 1, diagonal + cost) ;
+                    diagonal = above ;
+                }
+            }
+            return row[text.size()] ;
+        }
+        
+        std::string name_ ;
+        uint64_t    peq_[256] ;
+        size_t      max_distance_ ;
+        size_t      best_distance_ ;
+        std::string best_ ;
+    };
+
+#ifdef CLOPT_ENABLE_PROFILING
+    /***************************************
+     * Thread safe counter, which (unlike std::atomic) can be copied so
+     * that the objects holding it can still be cloned. Copies start
+     * counting from zero.
+     ***************************************/
+    class AccessCounter {
+    public:
+        AccessCounter() : count_(0) {}
+        AccessCounter(const AccessCounter&) : count_(0) {}
+        AccessCounter& operator=(const AccessCounter&) {return *this ;}
+        
+        void     increment() {count_.fetch_add(1, std::memory_order_relaxed) ;}
+        uint64_t get() const {return count_.load(std::memory_order_relaxed) ;}
+    private:
+        std::atomic<uint64_t> count_ ;
+    };
+#endif
+}
+
+class CLParamArena ;
+
+// Identifies the type of a parameter stored in a CLParamRegistry
+enum CLParamType {CL_BOOL, CL_DOUBLE, CL_INT, CL_STRING,
+                  CL_INT_LIST, CL_DOUBLE_LIST, CL_STRING_LIST} ;
+
+// Whether a parameter type holds a list of values
+inline bool CLIsListType(CLParamType type)
+{
+    return (type == CL_INT_LIST) || (type == CL_DOUBLE_LIST) || (type == CL_STRING_LIST) ;
+}
+
+// Text version of a parameter type, as shown in the help
+inline const char* CLTypeName(CLParamType type)
+{
+    switch (type) {
+        case CL_BOOL:        return "bool" ;
+        case CL_DOUBLE:      return "double" ;
+        case CL_INT:         return "int" ;
+        case CL_STRING:      return "string" ;
+        case CL_INT_LIST:    return "int list" ;
+        case CL_DOUBLE_LIST: return "double list" ;
+        case CL_STRING_LIST: return "string list" ;
+    }
+    return "unknown" ;
+}
+
+// Where the value of a parameter came from. Sources are listed from the
+// lowest to the highest precedence, so a value is only replaced by one
+// coming from the same or a higher source.
+enum CLSource {CL_SOURCE_DEFAULT,       // Default value given when defining the parameter
+               CL_SOURCE_CONFIGFILE,    // Configuration file
+               CL_SOURCE_ENVIRONMENT,   // Environment variable
+               CL_SOURCE_COMMANDLINE,   // Command line
+               CL_SOURCE_OVERRIDE} ;    // Set by the program itself
+
+// Text version of a source, e.g. for logging
+inline const char* CLSourceName(CLSource source)
+{
+    switch (source) {
+        case CL_SOURCE_DEFAULT:     return "default" ;
+        case CL_SOURCE_CONFIGFILE:  return "config file" ;
+        case CL_SOURCE_ENVIRONMENT: return "environment" ;
+        case CL_SOURCE_COMMANDLINE: return "command line" ;
+        case CL_SOURCE_OVERRIDE:    return "override" ;
+    }
+    return "unknown" ;
+}
+
+/***************************************
+ * CLParamBase
+ * Type independent base class for all command line parameter objects
+ ***************************************/
+class CLParamBase {
+public:
+    CLParamBase() : source(CL_SOURCE_DEFAULT) {}
+    CLParamBase(const std::string& param_name,
+                const std::string& info) :
+        parameter_name(param_name), description(info),
+        source(CL_SOURCE_DEFAULT)
+    {
+        if (description.empty()) description="No description for " + parameter_name + ". I guess you're on your own.";
+        std::vector<std::string> param_name_split = CLOptionsHelper::split(param_name, ',') ;
+        if (param_name_split.size() == 2) {
+            parameter_name_short = param_name_split[0][0] ;
+            parameter_name = param_name_split[1] ;
+        }
+    }
+    virtual ~CLParamBase() {}
+    
+    // Set the value of this parameter from its text representation
+    virtual CLConvertStatus setFromString(const char* str, size_t len) = 0 ;
+    // Create a copy of this parameter in 'arena'
+    virtual CLParamBase* clone(CLParamArena& arena) const = 0 ;
+    // Store/restore the value in binary form (used by snapshots)
+    virtual void appendBinary(std::string& out) const = 0 ;
+    virtual bool setFromBinary(const char* data, size_t size, CLSource new_source) = 0 ;
+    // Whether 'setFromBinary' would accept the data (without setting anything)
+    virtual bool checkBinary(const char* data, size_t size) const = 0 ;
+    // Print the information about the parameter
+    virtual void Print() const = 0 ;
+    virtual void PrintSimple() const = 0 ;
+    // Get the text representation of the current value. This is cached,
+    // and only recomputed when it's read after the value has changed.
+    virtual const std::string& getValueStr() const = 0 ;
+    // Recompute the text representation now if the value has changed,
+    // so that 'getValueStr' doesnt modify the parameter
+    virtual void updateValueStr() const = 0 ;
+    
+    // Store the text of a value without converting it, so that it's only
+    // converted when the value is first read. Returns false (and stores
+    // nothing) if the parameter must always hold the converted value.
+    virtual bool setPending(const char* str, size_t len) = 0 ;
+    // Convert the pending text (if any), returning the conversion status.
+    // This also brings the text representation up to date.
+    virtual CLConvertStatus resolvePending() const = 0 ;
+    // Go back to the default value, as if the parameter had never been set
+    virtual void resetToDefault() = 0 ;
+    bool isPending() const {return pending;}
+    // Result of converting the last pending text
+    CLConvertStatus getConvertStatus() const {return pending_status;}
+    
+    std::string getParamName() const {return parameter_name;}
+    char        getShortParamName() const {return parameter_name_short;}
+    std::string getShortParamNameStr() const {return std::string(1,parameter_name_short);}
+    std::string getFullParamName() const
+    {
+        std::string fullname = std::string("-")+parameter_name ;
+        if (parameter_name_short > 10) {
+            fullname = getShortParamNameStr()+", -"+fullname ;
+        }
+        return fullname ;
+    }
+    const char* getParamNameChar() const {return parameter_name.c_str() ;}
+    std::string getDescription() const {return description;}
+    bool isSet() const {return source != CL_SOURCE_DEFAULT;}
+    CLSource getSource() const {return CLSource(source);}
+    void setSource(CLSource new_source) {source = (unsigned char)new_source;}
+    
+    void setParamName(const std::string& newname) {parameter_name = newname;}
+    void setDescription(const std::string& newdesc) {description = newdesc;}
+    
+#ifdef CLOPT_ENABLE_PROFILING
+    // Number of times the parameter has been looked up by name
+    void     countAccess() const {access_count.increment() ;}
+    uint64_t getAccessCount() const {return access_count.get() ;}
+#endif
+protected:
+#ifdef CLOPT_ENABLE_PROFILING
+    mutable CLOptionsHelper::AccessCounter access_count ;
+#endif
+    std::string parameter_name ;
+    char        parameter_name_short = 0;
+    std::string description ;
+    unsigned char source ;      // CLSource of the current value
+    
+    // Text of a value that hasnt been converted yet, and the source of
+    // the value it replaces (which is put back if the text isnt valid)
+    std::string pending_text ;
+    unsigned char pending_prev_source = CL_SOURCE_DEFAULT ;
+    mutable bool pending = false ;
+    mutable CLConvertStatus pending_status = CL_CONVERT_OK ;
+private:
+};
+
+/***************************************
+ * CLParam
+ * Parent class for all command line parameter objects
+ ***************************************/
+template <typename T>
+class CLParam : public CLParamBase {
+public:
+    CLParam<T>() : CLParamBase() {};
+    CLParam<T>(const std::string& param_name,
+               const std::string& info,
+               T default_val) :
+        CLParamBase(param_name, info),
+        value(default_val), default_value(default_val)
+    {
+        updateValueStr() ;
+    }
+    virtual ~CLParam() {}
+    virtual CLParam<T>& operator=(const T& other)
+    {
+        value = other ;
+        source = CL_SOURCE_OVERRIDE ;
+        valueChanged() ;
+        return *this ;
+    }
+    inline operator T() const {if (pending) resolvePending() ; return value;}
+    T getDefault() const {return default_value;}
+    T getValue() const {if (pending) resolvePending() ; return value;}
+    const T& getValueRef() const {if (pending) resolvePending() ; return value;}
+    const std::string& getValueStr() const
+    {
+        if (pending) resolvePending() ;
+        updateValueStr() ;
+        return value_str ;
+    }
+    // Various parameter setters
+    void setDefault(T new_default)
+    {
+        default_value = new_default ;
+    }
+    void setValue(T new_value)
+    {
+        value = new_value;
+        source = CL_SOURCE_OVERRIDE ;
+        valueChanged() ;
+    }
+    
+    // Set the value from text, leaving it unchanged if the text isnt valid.
+    // The value is marked as an override unless 'setSource' is called after.
+    virtual CLConvertStatus setFromString(const char* str, size_t len)
+    {
+        CLConvertStatus status = CLOptionsHelper::convert(str, len, value) ;
+        if (status == CL_CONVERT_OK) {
+            source = CL_SOURCE_OVERRIDE ;
+            valueChanged() ;
+        }
+        return status ;
+    }
+    
+    // Keep the text of the value to be converted later
+    virtual bool setPending(const char* str, size_t len)
+    {
+        // Bound variables have to be updated straight away
+        if (bound_value != 0) return false ;
+        if (!pending) pending_prev_source = source ;
+        pending_text.assign(str, len) ;
+        pending = true ;
+        return true ;
+    }
+    virtual CLConvertStatus resolvePending() const
+    {
+        if (!pending) {
+            updateValueStr() ;
+            return pending_status ;
+        }
+        
+        // Note that the parameter objects themselves are never const (only
+        // the access to them), so the converted value can be stored here
+        CLParam<T>* self = const_cast<CLParam<T>*>(this) ;
+        CLConvertStatus status = CLOptionsHelper::convert(pending_text.data(), pending_text.size(), self->value) ;
+        if (status == CL_CONVERT_OK) {
+            self->valueChanged() ;
+        } else {
+            self->source = pending_prev_source ;
+            CLOptionsHelper::errors() << "[ERROR] CLParam::resolvePending() :: Invalid value \"" << pending_text
+                      << "\" for parameter \"" << parameter_name << "\" ("
+                      << CLOptionsHelper::convert_error(status) << ")" << std::endl;
+        }
+        pending = false ;
+        pending_status = status ;
+        self->pending_text.clear() ;
+        updateValueStr() ;
+        return status ;
+    }
+    
+    virtual void updateValueStr() const ;
+    virtual void resetToDefault()
+    {
+        // Most parameters are never set, so leave those alone
+        if ((source == CL_SOURCE_DEFAULT) && !pending && (pending_status == CL_CONVERT_OK) &&
+            (bound_value == 0) && (value == default_value)) return ;
+        value = default_value ;
+        source = CL_SOURCE_DEFAULT ;
+        pending_text.clear() ;
+        valueChanged() ;
+        updateValueStr() ;
+    }
+    
+    // Store the value in binary form
+    virtual void appendBinary(std::string& out) const
+    {
+        if (pending) resolvePending() ;
+        CLOptionsHelper::to_binary(value, out) ;
+    }
+    virtual bool setFromBinary(const char* data, size_t size, CLSource new_source)
+    {
+        if (!CLOptionsHelper::from_binary(data, size, value)) return false ;
+        source = (unsigned char)new_source ;
+        valueChanged() ;
+        return true ;
+    }
+    virtual bool checkBinary(const char* data, size_t size) const
+    {
+        return CLOptionsHelper::check_binary(data, size, value) ;
+    }
+    
+    // Bind this parameter to a variable owned by the user. Any value
+    // assigned to the parameter is then written straight to 'target'.
+    void bindTo(T* target)
+    {
+        bound_value = target ;
+        valueChanged() ;
+    }
+    
+    // Print the information about the parameter
+    virtual void Print() const
+    {
+        std::string default_str ;
+        CLOptionsHelper::to_string(default_value, default_str) ;
+        std::cout << "# " << description << std::endl ;
+        std::cout << "# [Default = " << default_str << "]" << std::endl;
+        PrintSimple() ;
+    }
+    virtual void PrintSimple() const
+    {
+        std::cout << parameter_name << " " << getValueStr() << std::endl ;
+    }
+protected:
+    // Used by the derived classes to implement 'clone'. Note that the
+    // copy isnt bound to the user's variable.
+    template <class Derived>
+    static CLParamBase* cloneAs(const Derived& param, CLParamArena& arena) ;
+    
+    // Mark the text version of the value as out of date and copy the value
+    // to the user's variable (if bound). Called whenever the value changes.
+    // The text is only rendered when it's needed, since most values are
+    // never read as text.
+    void valueChanged()
+    {
+        pending = false ;
+        pending_status = CL_CONVERT_OK ;
+        value_str_stale = true ;
+        if (bound_value != 0) *bound_value = value ;
+    }
+    
+    T value ;
+    T default_value ;
+    T* bound_value = 0;
+    mutable std::string value_str ;     // Cached text version of 'value'
+    mutable bool value_str_stale = true ;
+private:
+};
+
+template <typename T>
+void CLParam<T>::updateValueStr() const
+{
+    if (!value_str_stale) return ;
+    CLOptionsHelper::to_string(value, value_str) ;
+    value_str_stale = false ;
 }
 
+// String parameters are their own text version, so dont cache a copy
+template <>
+inline void CLParam<std::string>::updateValueStr() const {}
+template <>
+inline const std::string& CLParam<std::string>::getValueStr() const {return value;}
+// Converting text to a string is only a copy, so dont bother delaying it
+template <>
+inline bool CLParam<std::string>::setPending(const char*, size_t) {return false ;}
+
 /***************************************
- * CLParam
- * Parent class for all command line parameter objects
+ * CLParamArena
+ * Owns the memory for the parameter objects of a CLOptions object.
+ * Parameters are constructed in place in large blocks of memory, which
+ * avoids a separate heap allocation for every parameter. The blocks are
+ * never moved, so pointers to the parameters remain valid even when the
+ * arena itself is moved.
  ***************************************/
-template <typename T>
-class CLParam {
+class CLParamArena {
 public:
-    CLParam<T>() {};
-    CLParam<T>(const std::string& param_name,
-               const std::string& info,
-               T default_val) :
-        parameter_name(param_name), description(info),
-        value(default_val), default_value(default_val),
-        is_set(false)
+    CLParamArena() : block_used_(0), block_size_(0) {}
+    CLParamArena(CLParamArena&& other) :
+        blocks_(std::move(other.blocks_)), objects_(std::move(other.objects_)),
+        block_used_(other.block_used_), block_size_(other.block_size_)
     {
-        if (description.empty()) description="No description for " + parameter_name + ". I guess you're on your own.";
-        std::vector<std::string> param_name_split = CLOptionsHelper::split(param_name, ',') ;
-        if (param_name_split.size() == 2) {
-            parameter_name_short = param_name_split[0][0] ;
-            parameter_name = param_name_split[1] ;
-        }
+        other.Release() ;
     }
-    virtual ~CLParam() {}
-    virtual CLParam<T>& operator=(const T& other)
+    CLParamArena& operator=(CLParamArena&& other)
     {
-        value = other ;
+        if (this != &other) {
+            Clear() ;
+            blocks_     = std::move(other.blocks_) ;
+            objects_    = std::move(other.objects_) ;
+            block_used_ = other.block_used_ ;
+            block_size_ = other.block_size_ ;
+            other.Release() ;
+        }
         return *this ;
     }
-    inline operator T() {return value;}
-    T getDefault() {return default_value;}
-    T getValue() {return value;}
-    std::string getParamName() {return parameter_name;}
-    char        getShortParamName() {return parameter_name_short;}
-    std::string getShortParamNameStr() {return std::string(1,parameter_name_short);}
-    std::string getFullParamName()
+    CLParamArena(const CLParamArena& other) = delete ;
+    CLParamArena& operator=(const CLParamArena& other) = delete ;
+    virtual ~CLParamArena() {Clear() ;}
+    
+    // Construct a new parameter object in the arena
+    template <class T, class... Args>
+    T* Create(Args&&... args)
     {
-        std::string fullname = std::string("-")+parameter_name ;
-        if (parameter_name_short > 10) {
-            fullname = getShortParamNameStr()+", -"+fullname ;
-        }
-        return fullname ;
+        T* param = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...) ;
+        objects_.push_back(param) ;
+        return param ;
     }
-    const char* getParamNameChar() {return parameter_name.c_str() ;}
-    std::string getDescription() {return description;}
-    // Various parameter setters
-    void setDefault(T new_default)
+    
+    // Destroy a single parameter (its memory is reclaimed with the arena)
+    void Destroy(CLParamBase* param)
     {
-        default_value = new_default ;
-    }
-    void setValue(T new_value)
+        std::vector<CLParamBase*>::iterator obj = std::find(objects_.begin(), objects_.end(), param) ;
+        if (obj == objects_.end()) return ;
+        objects_.erase(obj) ;
+        param->~CLParamBase() ;
+    }
+    
+    // Position in the arena, to later destroy everything created after it
+    struct Mark {
+        size_t n_objects ;
+        size_t n_blocks ;
+        size_t block_used ;
+        size_t block_size ;
+    } ;
+    Mark GetMark() const
     {
-        value = new_value;
-        is_set = true ;
+        Mark mark = {objects_.size(), blocks_.size(), block_used_, block_size_} ;
+        return mark ;
     }
-    void setParamName(const std::string& newname) {parameter_name = newname;}
-    void setDescription(const std::string& newdesc) {description = newdesc;}
     
-    // Print the information about the parameter
-    void Print()
+    // Destroy the parameters created after 'mark' and release their memory.
+    // Note that none of the parameters created before it can have been
+    // destroyed since.
+    void Rewind(const Mark& mark)
     {
-        std::cout << "# " << description << std::endl ;
-        std::cout << "# [Default = " << default_value << "]" << std::endl;
-        PrintSimple() ;
+        for (size_t i=objects_.size(); i>mark.n_objects; i--) objects_[i-1]->~CLParamBase() ;
+        if (objects_.size() > mark.n_objects) objects_.resize(mark.n_objects) ;
+        for (size_t i=mark.n_blocks; i<blocks_.size(); i++) delete[] blocks_[i] ;
+        if (blocks_.size() > mark.n_blocks) blocks_.resize(mark.n_blocks) ;
+        block_used_ = mark.block_used ;
+        block_size_ = mark.block_size ;
     }
-    void PrintSimple()
+    
+    // Destroy all of the parameters and release the memory
+    void Clear()
     {
-        std::cout << parameter_name << " " << value << std::endl ;
+        for (size_t i=objects_.size(); i>0; i--) objects_[i-1]->~CLParamBase() ;
+        for (size_t i=0; i<blocks_.size(); i++) delete[] blocks_[i] ;
+        Release() ;
     }
+    
 protected:
-    std::string parameter_name ;
-    char        parameter_name_short = 0;
-    std::string description ;
-    T value ;
-    T default_value ;
-    bool is_set ;
+    // Get 'size' bytes of memory with the given alignment
+    void* Allocate(size_t size, size_t alignment)
+    {
+        size_t offset = (block_used_ + alignment - 1) & ~(alignment - 1) ;
+        if (blocks_.empty() || (offset + size > block_size_)) {
+            block_size_ = std::max(size, size_t(CLOPT_ARENA_BLOCK_SIZE)) ;
+            blocks_.push_back(new char[block_size_]) ;
+            offset = 0 ;
+        }
+        block_used_ = offset + size ;
+        return blocks_.back() + offset ;
+    }
+    
+    // Forget about all blocks and objects without freeing them
+    void Release()
+    {
+        blocks_.clear() ;
+        objects_.clear() ;
+        block_used_ = 0 ;
+        block_size_ = 0 ;
+    }
+    
+    std::vector<char*>        blocks_ ;
+    std::vector<CLParamBase*> objects_ ;    // Live parameters in creation order
+    size_t                    block_used_ ; // Bytes used in the last block
+    size_t                    block_size_ ; // Size of the last block
 private:
 };
 
+//__________________________________________________________
+template <typename T>
+template <class Derived>
+CLParamBase* CLParam<T>::cloneAs(const Derived& param, CLParamArena& arena)
+{
+    Derived* copy = arena.Create<Derived>(param) ;
+    copy->bound_value = 0 ;
+    return copy ;
+}
+
 /************************************************
  * Bool parameter
  ************************************************/
@@ -176,23 +1253,23 @@ public:
     CLBool() : CLParam<bool>() {};
     CLBool(const std::string& param_name,
            const std::string& info,
-           bool default_val,
-           std::map<std::string, CLBool*> &bool_map) :
+           bool default_val) :
     CLParam<bool>(param_name, info, default_val)
     {
         if (parameter_name_short == 0) parameter_name_short = 1;
-        bool_map[parameter_name] = this ;
     }
     CLBool& operator=(std::string& other) {
-        std::stringstream sstream ;
-        sstream << other ;
-        sstream >> value ;
+        setFromString(other.data(), other.size()) ;
         return *this ;
     }
     CLBool& operator=(bool other) {
         value = other ;
+        source = CL_SOURCE_OVERRIDE ;
+        valueChanged() ;
         return *this ;
     }
+    virtual CLParamBase* clone(CLParamArena& arena) const
+    {return cloneAs(*this, arena) ;}
 protected:
 private:
 };
@@ -205,31 +1282,33 @@ public:
     CLString() : CLParam<std::string>() {} ;
     CLString(const std::string& param_name,
              const std::string& info,
-             const std::string& default_val,
-             std::map<std::string, CLString*> &str_map) :
+             const std::string& default_val) :
     CLParam<std::string>(param_name, info, default_val)
     {
         if (parameter_name_short == 0) parameter_name_short = 2;
-        str_map[parameter_name] = this ;
     }
     CLString& operator=(std::string other) {
         value = other ;
+        source = CL_SOURCE_OVERRIDE ;
+        valueChanged() ;
         return *this ;
     }
     
     // Some methods relating to std::string. There's probably a better way to do this..
-    const char* c_str()
+    const char* c_str() const
     {return value.c_str() ;}
-    int compare(const std::string& str)
+    int compare(const std::string& str) const
     {return value.compare(str) ;}
-    size_t find(const std::string& str, size_t pos=0)
+    size_t find(const std::string& str, size_t pos=0) const
     {return value.find(str, pos) ;}
     bool empty() const
     {return value.empty();}
-    std::string operator+(const std::string& other) {
+    std::string operator+(const std::string& other) const {
         std::string new_str = value + other ;
         return new_str ;
     }
+    virtual CLParamBase* clone(CLParamArena& arena) const
+    {return cloneAs(*this, arena) ;}
 protected:
 private:
 };
@@ -241,25 +1320,23 @@ class CLDouble : public CLParam<double> {
 public:
     CLDouble(const std::string& param_name,
              const std::string& info,
-             double default_val,
-             std::map<std::string, CLDouble*> &dbl_map) :
+             double default_val) :
     CLParam<double>(param_name, info, default_val)
     {
         if (parameter_name_short == 0) parameter_name_short = 3;
-        dbl_map[parameter_name] = this ;
     }
     CLDouble& operator=(const std::string& other) {
-        std::stringstream sstream ;
-        sstream << other ;
-        sstream >> value ;
-        is_set = true ;
+        setFromString(other.data(), other.size()) ;
         return *this ;
     }
     CLDouble& operator=(double other) {
         value = other ;
-        is_set = true ;
+        source = CL_SOURCE_OVERRIDE ;
+        valueChanged() ;
         return *this ;
     }
+    virtual CLParamBase* clone(CLParamArena& arena) const
+    {return cloneAs(*this, arena) ;}
 protected:
 private:
 };
@@ -271,84 +1348,745 @@ class CLInt : public CLParam<int> {
 public:
     CLInt(const std::string& param_name,
           const std::string& info,
-          int default_val,
-          std::map<std::string, CLInt*> &int_map) :
+          int default_val) :
     CLParam<int>(param_name, info, default_val)
     {
         if (parameter_name_short == 0) parameter_name_short = 4;
-        int_map[parameter_name] = this ;
     }
     CLInt& operator=(const std::string& other) {
-        std::stringstream sstream ;
-        sstream << other ;
-        sstream >> value ;
-        is_set = true ;
+        setFromString(other.data(), other.size()) ;
         return *this ;
     }
     CLInt& operator=(int other) {
         value = other ;
-        is_set = true ;
+        source = CL_SOURCE_OVERRIDE ;
+        valueChanged() ;
+        return *this ;
+    }
+    virtual CLParamBase* clone(CLParamArena& arena) const
+    {return cloneAs(*this, arena) ;}
+protected:
+private:
+};
+
+
+/************************************************
+ * List parameter
+ * Holds a list of values of type T, which are passed as a single
+ * comma and/or space separated value (e.g. '--Bins 1,2,4,8')
+ ************************************************/
+template <typename T>
+class CLList : public CLParam<std::vector<T> > {
+public:
+    CLList(const std::string& param_name,
+           const std::string& info,
+           const std::vector<T>& default_val) :
+    CLParam<std::vector<T> >(param_name, info, default_val)
+    {
+        if (this->parameter_name_short == 0) this->parameter_name_short = 5;
+    }
+    CLList<T>& operator=(const std::string& other) {
+        this->setFromString(other.data(), other.size()) ;
         return *this ;
     }
+    
+    // Some methods relating to std::vector
+    size_t size() const
+    {return this->getValueRef().size() ;}
+    bool empty() const
+    {return this->getValueRef().empty() ;}
+    const T& operator[](size_t index) const
+    {return this->getValueRef()[index] ;}
+    
+    virtual CLParamBase* clone(CLParamArena& arena) const
+    {return CLParam<std::vector<T> >::cloneAs(*this, arena) ;}
+protected:
+private:
+};
+
+/***************************************
+ * CLHandle
+ * Lightweight typed handle to a parameter returned when the parameter
+ * is added. Reading the value through the handle goes straight to the
+ * parameter object without looking up the parameter name, which makes
+ * it suitable for use in tight loops. The handle remains valid for as
+ * long as the CLOptions object that returned it exists (and until a
+ * parameter with the same name is added again).
+ *
+ *    CLHandle<double> tol = options.AddDoubleParam("Tolerance", "...", 1.0e-6) ;
+ *    options.ParseCommandLine(argc, argv) ;
+ *    while (error > tol) { ... }
+ ***************************************/
+template <typename T>
+class CLHandle {
+public:
+    CLHandle() : param_(0) {}
+    explicit CLHandle(const CLParam<T>* param) : param_(param) {}
+    
+    const T& get() const {return param_->getValueRef() ;}
+    operator const T&() const {return param_->getValueRef() ;}
+    const T& operator*() const {return param_->getValueRef() ;}
+    const T* operator->() const {return &param_->getValueRef() ;}
+    
+    // Whether this handle actually refers to a parameter
+    bool valid() const {return param_ != 0 ;}
+    const CLParam<T>* param() const {return param_ ;}
 protected:
+    const CLParam<T>* param_ ;
 private:
 };
 
 
 /***************************************
- * CLOptions
- * Parent class for all command line parameter objects
+ * CLParamRegistry
+ * Flat storage for all of the parameters, indexed by parameter name
+ * through an open-addressing hash table. Each entry stores the type
+ * of the parameter next to a pointer to it, so that a lookup needs
+ * only a single probe sequence regardless of the parameter type.
  ***************************************/
-class CLOptions {
+class CLParamRegistry {
 public:
-    // Basic constructor
-    CLOptions() {} ;
-    // Destructor
-    virtual ~CLOptions()
+    struct Entry {
+        std::string  name ;
+        size_t       hash ;
+        CLParamType  type ;
+        CLParamBase* param ;
+    } ;
+    
+    CLParamRegistry() {}
+    
+    // Add a parameter, returning any parameter that previously
+    // had the same name (or null if there wasnt one)
+    CLParamBase* Insert(CLParamType type, CLParamBase* param)
     {
-        // Loop through each storage map and delete all objects
-        std::map<std::string, CLBool*>::iterator bool_itr ;
-        for (bool_itr=params_bools.begin(); bool_itr!=params_bools.end(); ++bool_itr)
-            if (bool_itr->second != 0) delete bool_itr->second ;
+        Entry entry ;
+        entry.name  = param->getParamName() ;
+        entry.hash  = Hash(entry.name.data(), entry.name.size()) ;
+        entry.type  = type ;
+        entry.param = param ;
         
-        std::map<std::string, CLDouble*>::iterator dbl_itr;
-        for (dbl_itr=params_doubles.begin(); dbl_itr!=params_doubles.end(); ++dbl_itr)
-            if (dbl_itr->second != 0) delete dbl_itr->second ;
+        // Replace an existing entry with the same name
+        size_t slot = FindSlot(entry.name.data(), entry.name.size(), entry.hash) ;
+        if (slots_.size() > 0 && slots_[slot] != 0) {
+            Entry& old_entry = entries_[slots_[slot]-1] ;
+            CLParamBase* old_param = old_entry.param ;
+            old_entry = entry ;
+            return old_param ;
+        }
         
-        std::map<std::string, CLInt*>::iterator int_itr;
-        for (int_itr=params_ints.begin(); int_itr!=params_ints.end(); ++int_itr)
-            if (int_itr->second != 0) delete int_itr->second ;
+        // Keep the table at most half full
+        entries_.push_back(entry) ;
+        if (2*entries_.size() > slots_.size()) {
+            Rehash(slots_.empty() ? 16 : 2*slots_.size()) ;
+        } else {
+            slots_[slot] = entries_.size() ;
+        }
+        return 0 ;
+    }
+    
+    // Find the entry for a given parameter name (null if it doesnt exist)
+    const Entry* Find(const char* name, size_t name_len) const
+    {
+        if (slots_.empty()) return 0 ;
+        size_t slot = FindSlot(name, name_len, Hash(name, name_len)) ;
+        return (slots_[slot] == 0) ? 0 : &entries_[slots_[slot]-1] ;
+    }
+    const Entry* Find(const std::string& name) const
+    {return Find(name.data(), name.size()) ;}
+    
+    // Replace the parameter object stored in a given entry
+    void SetEntryParam(size_t index, CLParamBase* param)
+    {entries_[index].param = param ;}
+    // Replace a given entry with one for the same name
+    void SetEntry(size_t index, const Entry& entry)
+    {entries_[index] = entry ;}
+    
+    // Remove all but the first 'n' entries
+    void Truncate(size_t n)
+    {
+        if (n >= entries_.size()) return ;
+        entries_.resize(n) ;
+        Rehash(slots_.size()) ;
+    }
+    
+    // Access to the entries in the order they were added
+    const std::vector<Entry>& Entries() const {return entries_ ;}
+    size_t size() const {return entries_.size() ;}
+    bool   empty() const {return entries_.empty() ;}
+    
+    // Get the entries of a given type sorted by name
+    std::vector<const Entry*> Sorted(CLParamType type) const
+    {
+        std::vector<const Entry*> sorted ;
+        for (size_t i=0; i<entries_.size(); i++) {
+            if (entries_[i].type == type) sorted.push_back(&entries_[i]) ;
+        }
+        std::sort(sorted.begin(), sorted.end(), CompareNames) ;
+        return sorted ;
+    }
+    
+    // FNV-1a hash of the parameter name
+    static size_t Hash(const char* name, size_t name_len)
+    {
+        size_t hash = 2166136261u ;
+        for (size_t i=0; i<name_len; i++) {
+            hash = (hash ^ (unsigned char)name[i]) * 16777619u ;
+        }
+        return hash ;
+    }
+    
+protected:
+    // Returns the slot holding 'name' or the empty slot where it would go
+    size_t FindSlot(const char* name, size_t name_len, size_t hash) const
+    {
+        if (slots_.empty()) return 0 ;
+        size_t mask = slots_.size() - 1 ;
+        for (size_t slot = hash & mask; ; slot = (slot+1) & mask) {
+            if (slots_[slot] == 0) return slot ;
+            const Entry& entry = entries_[slots_[slot]-1] ;
+            if ((entry.hash == hash) && (entry.name.size() == name_len) &&
+                (std::memcmp(entry.name.data(), name, name_len) == 0)) {
+                return slot ;
+            }
+        }
+    }
+    
+    void Rehash(size_t new_size)
+    {
+        slots_.assign(new_size, 0) ;
+        for (size_t i=0; i<entries_.size(); i++) {
+            size_t slot = entries_[i].hash & (new_size-1) ;
+            while (slots_[slot] != 0) slot = (slot+1) & (new_size-1) ;
+            slots_[slot] = i+1 ;
+        }
+    }
+    
+    static bool CompareNames(const Entry* a, const Entry* b)
+    {return a->name < b->name ;}
+    
+    std::vector<Entry>  entries_ ;
+    std::vector<size_t> slots_ ;     // Index+1 into 'entries_', 0 means empty
+private:
+};
+
+/***************************************
+ * CLNameIndex
+ * Sorted array of the long option names, used to resolve the names
+ * given on the command line (and unambiguous abbreviations of them)
+ * with a binary search. The names are copied into a single buffer so
+ * that the index stays valid when the options are moved or cloned.
+ ***************************************/
+class CLNameIndex {
+public:
+    enum {NO_MATCH = -1, AMBIGUOUS_MATCH = -2} ;
+    
+    void Clear() {names_.clear() ; records_.clear() ;}
+    
+    // Add a name with the (non-negative) id to return when it's matched.
+    // 'Sort' has to be called once all of the names have been added.
+    void Add(const std::string& name, int id)
+    {
+        Record record = {uint32_t(names_.size()), uint32_t(name.size()), id} ;
+        names_ += name ;
+        records_.push_back(record) ;
+    }
+    // Names added first win if the same name is added twice
+    void Sort() {std::stable_sort(records_.begin(), records_.end(), Less(names_)) ;}
+    
+    // Returns the id of 'name' if it's in the index, otherwise the id of
+    // the only name starting with 'name'. Returns NO_MATCH if no name
+    // starts with it and AMBIGUOUS_MATCH if more than one name does.
+    int Match(const char* name, size_t name_len) const
+    {
+        // An exact match sorts before all of the longer names starting with it
+        std::vector<Record>::const_iterator first = LowerBound(name, name_len) ;
+        if ((first == records_.end()) || !HasPrefix(*first, name, name_len)) return NO_MATCH ;
+        if (first->len == name_len) return first->id ;
         
-        std::map<std::string, CLString*>::iterator str_itr ;
-        for (str_itr=params_strings.begin(); str_itr!=params_strings.end(); ++str_itr)
-            if (str_itr->second != 0) delete str_itr->second ;
+        std::vector<Record>::const_iterator next = first + 1 ;
+        if ((next != records_.end()) && HasPrefix(*next, name, name_len)) return AMBIGUOUS_MATCH ;
+        return first->id ;
+    }
+    
+    // All of the names starting with 'name', sorted
+    std::vector<std::string> Candidates(const char* name, size_t name_len) const
+    {
+        std::vector<std::string> candidates ;
+        for (std::vector<Record>::const_iterator it = LowerBound(name, name_len);
+             (it != records_.end()) && HasPrefix(*it, name, name_len); ++it) {
+            candidates.push_back(names_.substr(it->offset, it->len)) ;
+        }
+        return candidates ;
+    }
+    
+    size_t size() const {return records_.size() ;}
+
+protected:
+    struct Record {
+        uint32_t offset ;   // Position of the name in 'names_'
+        uint32_t len ;
+        int      id ;
+    } ;
+    
+    struct Less {
+        explicit Less(const std::string& names) : names_(names) {}
+        bool operator()(const Record& a, const Record& b) const
+        {return Compare(names_, a, names_.data() + b.offset, b.len) < 0 ;}
+        const std::string& names_ ;
+    } ;
+    
+    // Compare the name of 'record' with 'name' (as std::string::compare)
+    static int Compare(const std::string& names, const Record& record,
+                       const char* name, size_t name_len)
+    {
+        int cmp = std::memcmp(names.data() + record.offset, name, std::min<size_t>(record.len, name_len)) ;
+        if (cmp != 0) return cmp ;
+        return (record.len < name_len) ? -1 : (record.len > name_len) ? 1 : 0 ;
+    }
+    
+    // First record whose name isnt less than 'name'
+    std::vector<Record>::const_iterator LowerBound(const char* name, size_t name_len) const
+    {
+        std::vector<Record>::const_iterator first = records_.begin() ;
+        size_t count = records_.size() ;
+        while (count > 0) {
+            size_t half = count / 2 ;
+            if (Compare(names_, first[half], name, name_len) < 0) {
+                first += half + 1 ;
+                count -= half + 1 ;
+            } else {
+                count = half ;
+            }
+        }
+        return first ;
+    }
+    
+    bool HasPrefix(const Record& record, const char* name, size_t name_len) const
+    {
+        return (record.len >= name_len) &&
+               (std::memcmp(names_.data() + record.offset, name, name_len) == 0) ;
+    }
+    
+    std::string         names_ ;     // All of the names, one after the other
+    std::vector<Record> records_ ;   // Sorted by name
+private:
+};
+
+
+/***************************************
+ * CLFrozenOptions
+ * Immutable copy of the values of a CLOptions object, created with
+ * 'CLOptions::Freeze()'. The values are stored in one array per type
+ * and the names in a single buffer, so the whole object is only a
+ * handful of allocations. Nothing is modified after construction,
+ * so a single object can be read from any number of threads at once.
+ ***************************************/
+class CLFrozenOptions {
+public:
+    CLFrozenOptions() {}
+    explicit CLFrozenOptions(const CLParamRegistry& params) ;
+    CLFrozenOptions(const CLFrozenOptions& other) = default ;
+    CLFrozenOptions(CLFrozenOptions&& other) = default ;
+    CLFrozenOptions& operator=(const CLFrozenOptions& other) = default ;
+    CLFrozenOptions& operator=(CLFrozenOptions&& other) = default ;
+    virtual ~CLFrozenOptions() {}
+    
+    // Same accessors as CLOptions
+    const std::string& operator[](const std::string& param_name) const ;
+    bool        AsBool  (const std::string& param_name) const ;
+    double      AsDouble(const std::string& param_name) const ;
+    int         AsInt   (const std::string& param_name) const ;
+    const std::string& AsString(const std::string& param_name) const ;
+    const std::vector<int>&         AsIntList   (const std::string& param_name) const ;
+    const std::vector<double>&      AsDoubleList(const std::string& param_name) const ;
+    const std::vector<std::string>& AsStringList(const std::string& param_name) const ;
+    
+    // Return whether parameter exists
+    bool HasPar(const std::string& param_name) const
+    {return Find(param_name) != 0 ;}
+    // Get where the value of a parameter came from
+    CLSource GetSource(const std::string& param_name) const
+    {
+        const Entry* entry = Find(param_name) ;
+        return (entry == 0) ? CL_SOURCE_DEFAULT : CLSource(entry->source) ;
+    }
+    // Number of parameters
+    size_t size() const {return entries_.size() ;}
+    
+protected:
+    struct Entry {
+        size_t      hash ;
+        uint32_t    name_offset ;   // Position of the name in 'names_'
+        uint32_t    name_len ;
+        uint32_t    value ;         // Index into the array for 'type'
+        uint32_t    value_str ;     // Index into 'value_strs_' (not used for strings)
+        CLParamType type ;
+        CLSource    source ;
     } ;
     
+    // Find the entry for a given parameter (null if it doesnt exist)
+    const Entry* Find(const std::string& name) const
+    {
+        if (slots_.empty()) return 0 ;
+        size_t hash = CLParamRegistry::Hash(name.data(), name.size()) ;
+        size_t mask = slots_.size() - 1 ;
+        for (size_t slot = hash & mask; slots_[slot] != 0; slot = (slot+1) & mask) {
+            const Entry& entry = entries_[slots_[slot]-1] ;
+            if ((entry.hash == hash) && (entry.name_len == name.size()) &&
+                (names_.compare(entry.name_offset, entry.name_len, name) == 0)) {
+                return &entry ;
+            }
+        }
+        return 0 ;
+    }
+    // Find an entry and check its type, printing an error if it doesnt match
+    const Entry* FindTyped(const std::string& name, CLParamType type,
+                           const char* method, const char* type_name) const
+    {
+        const Entry* entry = Find(name) ;
+        if ((entry == 0) || (entry->type != type)) {
+            CLOptionsHelper::errors() << "[ERROR] CLFrozenOptions::" << method << "() :: Parameter \"" << name << "\" is not " << type_name << "!" << std::endl;
+            return 0 ;
+        }
+        return entry ;
+    }
+    
+    std::string           names_ ;       // All parameter names back to back
+    std::vector<Entry>    entries_ ;
+    std::vector<uint32_t> slots_ ;       // Index+1 into 'entries_', 0 means empty
+    
+    std::vector<bool>        bools_ ;
+    std::vector<double>      doubles_ ;
+    std::vector<int>         ints_ ;
+    std::vector<std::string> strings_ ;
+    std::vector<std::vector<int> >         int_lists_ ;
+    std::vector<std::vector<double> >      double_lists_ ;
+    std::vector<std::vector<std::string> > string_lists_ ;
+    std::vector<std::string> value_strs_ ;  // Text versions of the non-string values
+private:
+};
+
+
+//__________________________________________________________
+CLFrozenOptions::CLFrozenOptions(const CLParamRegistry& params)
+{
+    const std::vector<CLParamRegistry::Entry>& entries = params.Entries() ;
+    entries_.reserve(entries.size()) ;
+    for (size_t i=0; i<entries.size(); i++) {
+        const CLParamRegistry::Entry& source = entries[i] ;
+        Entry entry ;
+        entry.hash        = source.hash ;
+        entry.name_offset = uint32_t(names_.size()) ;
+        entry.name_len    = uint32_t(source.name.size()) ;
+        entry.value_str   = uint32_t(value_strs_.size()) ;
+        entry.type        = source.type ;
+        if (source.param->isPending()) source.param->resolvePending() ;
+        entry.source      = source.param->getSource() ;
+        names_ += source.name ;
+        
+        // Copy the value into the array for its type
+        switch (source.type) {
+            case CL_BOOL:
+                entry.value = uint32_t(bools_.size()) ;
+                bools_.push_back(static_cast<const CLBool*>(source.param)->getValue()) ;
+                break ;
+            case CL_DOUBLE:
+                entry.value = uint32_t(doubles_.size()) ;
+                doubles_.push_back(static_cast<const CLDouble*>(source.param)->getValue()) ;
+                break ;
+            case CL_INT:
+                entry.value = uint32_t(ints_.size()) ;
+                ints_.push_back(static_cast<const CLInt*>(source.param)->getValue()) ;
+                break ;
+            case CL_STRING:
+                entry.value = uint32_t(strings_.size()) ;
+                strings_.push_back(static_cast<const CLString*>(source.param)->getValueRef()) ;
+                break ;
+            case CL_INT_LIST:
+                entry.value = uint32_t(int_lists_.size()) ;
+                int_lists_.push_back(static_cast<const CLList<int>*>(source.param)->getValueRef()) ;
+                break ;
+            case CL_DOUBLE_LIST:
+                entry.value = uint32_t(double_lists_.size()) ;
+                double_lists_.push_back(static_cast<const CLList<double>*>(source.param)->getValueRef()) ;
+                break ;
+            case CL_STRING_LIST:
+                entry.value = uint32_t(string_lists_.size()) ;
+                string_lists_.push_back(static_cast<const CLList<std::string>*>(source.param)->getValueRef()) ;
+                break ;
+        }
+        if (source.type != CL_STRING) value_strs_.push_back(source.param->getValueStr()) ;
+        entries_.push_back(entry) ;
+    }
+    
+    // Build the lookup table, keeping it at most half full
+    size_t n_slots = 16 ;
+    while (n_slots < 2*entries_.size()) n_slots *= 2 ;
+    slots_.assign(n_slots, 0) ;
+    for (size_t i=0; i<entries_.size(); i++) {
+        size_t slot = entries_[i].hash & (n_slots-1) ;
+        while (slots_[slot] != 0) slot = (slot+1) & (n_slots-1) ;
+        slots_[slot] = uint32_t(i+1) ;
+    }
+}
+
+//__________________________________________________________
+const std::string& CLFrozenOptions::operator[](const std::string& param_name) const
+{
+    const Entry* entry = Find(param_name) ;
+    if (entry == 0) {
+        CLOptionsHelper::errors() << "[ERROR] Unknown command line parameter: " << param_name << std::endl;
+        return CLOptionsHelper::empty_string() ;
+    }
+    
+    if (entry->type == CL_STRING) return strings_[entry->value] ;
+    return value_strs_[entry->value_str] ;
+}
+
+//__________________________________________________________
+bool CLFrozenOptions::AsBool(const std::string& param_name) const
+{
+    const Entry* entry = FindTyped(param_name, CL_BOOL, "AsBool", "a bool") ;
+    return (entry == 0) ? false : bools_[entry->value] ;
+}
+
+//__________________________________________________________
+double CLFrozenOptions::AsDouble(const std::string& param_name) const
+{
+    const Entry* entry = FindTyped(param_name, CL_DOUBLE, "AsDouble", "a double") ;
+    return (entry == 0) ? 0 : doubles_[entry->value] ;
+}
+
+//__________________________________________________________
+int CLFrozenOptions::AsInt(const std::string& param_name) const
+{
+    const Entry* entry = FindTyped(param_name, CL_INT, "AsInt", "an integer") ;
+    return (entry == 0) ? 0 : ints_[entry->value] ;
+}
+
+//__________________________________________________________
+const std::string& CLFrozenOptions::AsString(const std::string& param_name) const
+{
+    const Entry* entry = FindTyped(param_name, CL_STRING, "AsString", "a string") ;
+    return (entry == 0) ? CLOptionsHelper::empty_string() : strings_[entry->value] ;
+}
+
+//__________________________________________________________
+const std::vector<int>& CLFrozenOptions::AsIntList(const std::string& param_name) const
+{
+    static const std::vector<int> empty_list ;
+    const Entry* entry = FindTyped(param_name, CL_INT_LIST, "AsIntList", "a integer list") ;
+    return (entry == 0) ? empty_list : int_lists_[entry->value] ;
+}
+
+//__________________________________________________________
+const std::vector<double>& CLFrozenOptions::AsDoubleList(const std::string& param_name) const
+{
+    static const std::vector<double> empty_list ;
+    const Entry* entry = FindTyped(param_name, CL_DOUBLE_LIST, "AsDoubleList", "a double list") ;
+    return (entry == 0) ? empty_list : double_lists_[entry->value] ;
+}
+
+//__________________________________________________________
+const std::vector<std::string>& CLFrozenOptions::AsStringList(const std::string& param_name) const
+{
+    static const std::vector<std::string> empty_list ;
+    const Entry* entry = FindTyped(param_name, CL_STRING_LIST, "AsStringList", "a string list") ;
+    return (entry == 0) ? empty_list : string_lists_[entry->value] ;
+}
+
+
+/***************************************
+ * CLParseStats
+ * Time spent (in nanoseconds) in each phase of the last call to
+ * 'ParseCommandLine', along with some counters. These are only filled
+ * when CLOPT_ENABLE_STATS is defined, otherwise they're always zero.
+ ***************************************/
+struct CLParseStats {
+    typedef std::chrono::steady_clock Clock ;
+    
+    uint64_t define_params_ns = 0 ;  // Building the option lookup tables (only after options are added)
+    uint64_t scan_ns          = 0 ;  // Scanning argv for options
+    uint64_t environment_ns   = 0 ;  // Reading the environment variables
+    uint64_t config_file_ns   = 0 ;  // Reading the configuration file
+    uint64_t command_line_ns  = 0 ;  // Setting the values passed on the command line
+    uint64_t conversion_ns    = 0 ;  // Converting text to values (included in the three above)
+    uint64_t total_ns         = 0 ;
+    
+    uint64_t options_seen     = 0 ;  // Options found on the command line
+    uint64_t bytes_read       = 0 ;  // Size of the configuration files read
+    uint64_t lines_read       = 0 ;  // Lines in the configuration files read
+    uint64_t conversions      = 0 ;  // Values converted from text
+    uint64_t conversion_errors = 0 ;
+    
+    // Nanoseconds since 'start'
+    static uint64_t Since(Clock::time_point start)
+    {return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() ;}
+    
+    // Adds the time spent in a scope to a given counter
+    class Timer {
+    public:
+        explicit Timer(uint64_t& counter) : counter_(counter), start_(Clock::now()) {}
+        ~Timer() {counter_ += Since(start_) ;}
+    private:
+        uint64_t&         counter_ ;
+        Clock::time_point start_ ;
+    };
+    
+    // Print the statistics
+    void Print() const
+    {
+        std::printf("CLOptions parse statistics:\n") ;
+        std::printf("  %-16s %12.3f us\n", "Lookup tables", define_params_ns * 1.0e-3) ;
+        std::printf("  %-16s %12.3f us\n", "Scan argv",     scan_ns * 1.0e-3) ;
+        std::printf("  %-16s %12.3f us\n", "Environment",   environment_ns * 1.0e-3) ;
+        std::printf("  %-16s %12.3f us\n", "Config file",   config_file_ns * 1.0e-3) ;
+        std::printf("  %-16s %12.3f us\n", "Command line",  command_line_ns * 1.0e-3) ;
+        std::printf("  %-16s %12.3f us\n", "(conversions)", conversion_ns * 1.0e-3) ;
+        std::printf("  %-16s %12.3f us\n", "Total",         total_ns * 1.0e-3) ;
+        std::printf("  options seen %llu, bytes read %llu, lines read %llu, conversions %llu (%llu errors)\n",
+                    (unsigned long long)options_seen, (unsigned long long)bytes_read,
+                    (unsigned long long)lines_read, (unsigned long long)conversions,
+                    (unsigned long long)conversion_errors) ;
+    }
+};
+
+
+/***************************************
+ * CLOptions
+ * Parent class for all command line parameter objects
+ ***************************************/
+class CLOptions {
+public:
+    // Basic constructor
+    CLOptions() {} ;
+    // Destructor (the parameter objects are destroyed with the arena)
+    virtual ~CLOptions() {} ;
+    
+    // CLOptions objects can be moved cheaply (e.g. returned from a method
+    // defining the options or handed to another thread). Handles returned
+    // by the 'Add*Param' methods remain valid after a move. Copies must be
+    // made explicitly with 'Clone()'.
+    CLOptions(CLOptions&& other) = default ;
+    CLOptions& operator=(CLOptions&& other) = default ;
+    CLOptions(const CLOptions& other) = delete ;
+    CLOptions& operator=(const CLOptions& other) = delete ;
+    
+    // Create an independent copy of these options (including the current
+    // values). Note that the copy is not bound to any user variables.
+    CLOptions Clone() const ;
+    
+    // Create an immutable copy of the current values, which can be shared
+    // by reference between threads (e.g. after parsing the command line)
+    CLFrozenOptions Freeze() const {return CLFrozenOptions(params_) ;}
+    
     
     // Methods for adding parameters of a specific type
-    void AddBoolParam(const std::string& param_name,
-                      const std::string& param_descrip,
-                      bool default_val)
+    CLHandle<bool> AddBoolParam(const std::string& param_name,
+                                const std::string& param_descrip,
+                                bool default_val)
+    {
+        CLBool* param = params_arena_.Create<CLBool>(param_name, param_descrip, default_val) ;
+        AddParam(CL_BOOL, param) ;
+        return CLHandle<bool>(param) ;
+    }
+    CLHandle<double> AddDoubleParam(const std::string& param_name,
+                                    const std::string& param_descrip,
+                                    double default_val)
+    {
+        CLDouble* param = params_arena_.Create<CLDouble>(param_name, param_descrip, default_val) ;
+        AddParam(CL_DOUBLE, param) ;
+        return CLHandle<double>(param) ;
+    }
+    CLHandle<int> AddIntParam(const std::string& param_name,
+                              const std::string& param_descrip,
+                              int default_val)
     {
-        new CLBool(param_name, param_descrip, default_val, params_bools) ;
+        CLInt* param = params_arena_.Create<CLInt>(param_name, param_descrip, default_val) ;
+        AddParam(CL_INT, param) ;
+        return CLHandle<int>(param) ;
     }
-    void AddDoubleParam(const std::string& param_name,
-                        const std::string& param_descrip,
-                        double default_val)
+    CLHandle<std::string> AddStringParam(const std::string& param_name,
+                                         const std::string& param_descrip,
+                                         std::string default_val)
+    {
+        CLString* param = params_arena_.Create<CLString>(param_name, param_descrip, default_val) ;
+        AddParam(CL_STRING, param) ;
+        return CLHandle<std::string>(param) ;
+    }
+    
+    // Methods for adding parameters that hold a list of values, which are
+    // passed as comma and/or space separated values. For example:
+    //
+    //    options.AddDoubleListParam("Bins", "Energy bin edges", {0.1, 1.0, 10.0}) ;
+    //    ./program --Bins 0.1,0.3,1.0,3.0,10.0
+    CLHandle<std::vector<int> > AddIntListParam(const std::string& param_name,
+                                                const std::string& param_descrip,
+                                                const std::vector<int>& default_val = std::vector<int>())
     {
-        new CLDouble(param_name, param_descrip, default_val, params_doubles) ;
+        CLList<int>* param = params_arena_.Create<CLList<int> >(param_name, param_descrip, default_val) ;
+        AddParam(CL_INT_LIST, param) ;
+        return CLHandle<std::vector<int> >(param) ;
     }
-    void AddIntParam(const std::string& param_name,
-                     const std::string& param_descrip,
-                     int default_val)
+    CLHandle<std::vector<double> > AddDoubleListParam(const std::string& param_name,
+                                                      const std::string& param_descrip,
+                                                      const std::vector<double>& default_val = std::vector<double>())
     {
-        new CLInt(param_name, param_descrip, default_val, params_ints) ;
+        CLList<double>* param = params_arena_.Create<CLList<double> >(param_name, param_descrip, default_val) ;
+        AddParam(CL_DOUBLE_LIST, param) ;
+        return CLHandle<std::vector<double> >(param) ;
     }
-    void AddStringParam(const std::string& param_name,
-                        const std::string& param_descrip,
-                        std::string default_val)
+    CLHandle<std::vector<std::string> > AddStringListParam(const std::string& param_name,
+                                                           const std::string& param_descrip,
+                                                           const std::vector<std::string>& default_val = std::vector<std::string>())
+    {
+        CLList<std::string>* param = params_arena_.Create<CLList<std::string> >(param_name, param_descrip, default_val) ;
+        AddParam(CL_STRING_LIST, param) ;
+        return CLHandle<std::vector<std::string> >(param) ;
+    }
+    
+    // Methods for adding parameters that are bound to a variable owned by
+    // the user (such as a member of a configuration struct). The current
+    // value of the variable is used as the default, and any value passed
+    // for the parameter is written directly into the variable. Note that
+    // the variable must outlive this CLOptions object. For example:
+    //
+    //    options.BindIntParam("Threads", "Number of worker threads", config.n_threads) ;
+    CLHandle<bool> BindBoolParam(const std::string& param_name,
+                                 const std::string& param_descrip,
+                                 bool& target)
+    {
+        CLBool* param = params_arena_.Create<CLBool>(param_name, param_descrip, target) ;
+        param->bindTo(&target) ;
+        AddParam(CL_BOOL, param) ;
+        return CLHandle<bool>(param) ;
+    }
+    CLHandle<double> BindDoubleParam(const std::string& param_name,
+                                     const std::string& param_descrip,
+                                     double& target)
     {
-        new CLString(param_name, param_descrip, default_val, params_strings) ;
+        CLDouble* param = params_arena_.Create<CLDouble>(param_name, param_descrip, target) ;
+        param->bindTo(&target) ;
+        AddParam(CL_DOUBLE, param) ;
+        return CLHandle<double>(param) ;
+    }
+    CLHandle<int> BindIntParam(const std::string& param_name,
+                               const std::string& param_descrip,
+                               int& target)
+    {
+        CLInt* param = params_arena_.Create<CLInt>(param_name, param_descrip, target) ;
+        param->bindTo(&target) ;
+        AddParam(CL_INT, param) ;
+        return CLHandle<int>(param) ;
+    }
+    CLHandle<std::string> BindStringParam(const std::string& param_name,
+                                          const std::string& param_descrip,
+                                          std::string& target)
+    {
+        CLString* param = params_arena_.Create<CLString>(param_name, param_descrip, target) ;
+        param->bindTo(&target) ;
+        AddParam(CL_STRING, param) ;
+        return CLHandle<std::string>(param) ;
     }
     
     // Here are some additional parameters that fall outside the typical parameters...
@@ -374,6 +2112,7 @@ public:
     void AddProgramDescription(const std::string& desc)
     {
         program_desc_ = desc ;
+        help_cache_valid_ = false ;
     }
     
     
@@ -390,7 +2129,26 @@ public:
         version_opt.setParamName(version_str) ;
         version_opt.setDescription(version_opt_desc) ;
         version_opt.setValue(text_to_be_printed) ;
+        help_cache_valid_ = false ;
+        tables_valid_ = false ;
+    }
+    
+    // Add a subcommand (as in 'git commit'). The first positional argument
+    // on the command line selects the subcommand, and only then is 'factory'
+    // called to add the parameters of that subcommand. Programs with many
+    // subcommands therefore only pay for the one that's used. Note that
+    // only the global options can be given before the subcommand.
+    void AddSubcommand(const std::string& name,
+                       const std::string& description,
+                       std::function<void(CLOptions&)> factory)
+    {
+        Subcommand& subcommand = subcommands_[name] ;
+        subcommand.description = description ;
+        subcommand.factory     = factory ;
+        help_cache_valid_ = false ;
     }
+    // Name of the subcommand selected on the command line (empty if none)
+    const std::string& GetSubcommand() const {return subcommand_ ;}
     
     // This method actually sets the options from the passed command line arguements
     bool ParseCommandLine(int argc, char ** argv) ;
@@ -398,53 +2156,194 @@ public:
     std::map<int,std::string> GetShortOpts(std::string& short_opts) ;
     
     // Overload operator for getting objects as strings
-    std::string operator[](std::string param_name) ;
-    bool        AsBool  (const std::string& param_name) ;
-    double      AsDouble(const std::string& param_name) ;
-    int         AsInt   (const std::string& param_name) ;
-    std::string AsString(const std::string& param_name) ;
+    // Note that these return references to the stored (text) values, so
+    // they dont allocate memory
+    const std::string& operator[](const std::string& param_name) const ;
+    bool        AsBool  (const std::string& param_name) const ;
+    double      AsDouble(const std::string& param_name) const ;
+    int         AsInt   (const std::string& param_name) const ;
+    const std::string& AsString(const std::string& param_name) const ;
+    const std::vector<int>&         AsIntList   (const std::string& param_name) const ;
+    const std::vector<double>&      AsDoubleList(const std::string& param_name) const ;
+    const std::vector<std::string>& AsStringList(const std::string& param_name) const ;
     
     // Return whether parameter exists
-    bool HasPar(const std::string& param_name);
+    bool HasPar(const std::string& param_name) const ;
 
     // Print the values
-    void PrintDetailed() ;  // With description
-    void PrintSimple() ;    // Without description
-    void PrintBools(bool detailed=false) ;      // Print only the bools
-    void PrintDoubles(bool detailed=false) ;    // Print only the doubles
-    void PrintInts(bool detailed=false) ;       // Print only the integers
-    void PrintStrings(bool detailed=false) ;    // Print only the strings
-    
-    // Print the help information (i.e. all of the parameters and their descriptions)
+    void PrintDetailed() const ;  // With description
+    void PrintSimple() const ;    // Without description
+    void PrintBools(bool detailed=false) const ;      // Print only the bools
+    void PrintDoubles(bool detailed=false) const ;    // Print only the doubles
+    void PrintInts(bool detailed=false) const ;       // Print only the integers
+    void PrintStrings(bool detailed=false) const ;    // Print only the strings
+    void PrintLists(bool detailed=false) const ;      // Print only the lists
+    
+    // Print the help information (i.e. all of the parameters and their descriptions).
+    // Descriptions are wrapped to the width of the terminal. The text is
+    // rendered once and reused until the parameters change.
     void PrintHelp(const std::string& executable_name) ;
     void PrintDescription(const std::string& param_description,
                           int left_padding = CLOPT_PAD_DESCRIPTION_WIDTH) ;
     
+    // Save the current values of all parameters to a compact binary file,
+    // which can later be loaded with 'LoadSnapshot' into a CLOptions object
+    // defining the same parameters. Loading a snapshot only requires mapping
+    // the file and copying the values, without parsing any text, so it is
+    // much faster than reading a large configuration file. Note that the
+    // snapshot is only valid on machines with the same byte order. These
+    // methods return true when there has been an error.
+    bool SaveSnapshot(const std::string& filename) const ;
+    bool LoadSnapshot(const std::string& filename) ;
+    
+    // Fill the options from the environment variables whose names start
+    // with 'prefix'. The rest of the variable name is matched against the
+    // parameter names in upper case, with any '-' replaced by '_'. For
+    // example, with the prefix "MYAPP_" the variable MYAPP_OUTPUTFILE sets
+    // the parameter "OutputFile". The whole value of the variable is used.
+    // A variable matching several parameters (e.g. both "Foo-Bar" and
+    // "FOO_BAR") is an error. Returns true if there has been an error.
+    bool FillFromEnvironment(const std::string& prefix) ;
+    // In lazy mode, values are only stored as text while parsing and are
+    // converted the first time they're read, so that values which are never
+    // used arent converted at all. Invalid values are then reported when
+    // they're read (keeping the previous value), or by 'ConvertPending'.
+    // Strings and bound parameters are always set straight away. Note that
+    // reading a value for the first time modifies it, so call
+    // 'ConvertPending' (or 'Freeze') before reading from several threads.
+    void SetLazyConversion(bool lazy) {lazy_conversion_ = lazy ;}
+    // Whether configuration files are memory mapped (the default) or read.
+    // Files that may be truncated while they're being read should be read,
+    // since a truncated mapping kills the program with SIGBUS.
+    void SetMapConfigFiles(bool map) {map_config_files_ = map ;}
+    // Convert all of the values still stored as text. Returns true if any
+    // of them are invalid.
+    bool ConvertPending() ;
+    
+    // Put every parameter back to its default value and forget where the
+    // values came from, as if nothing had been parsed, so that another
+    // command line can be parsed with the same options. The parameters
+    // added once a subcommand was selected are removed (and any they
+    // replaced put back), so no subcommand is selected afterwards.
+    void Reset() ;
+    
+    // Set the prefix of the environment variables read by 'ParseCommandLine'
+    // (environment variables arent read if this isnt set)
+    void SetEnvironmentPrefix(const std::string& prefix)
+    {env_prefix_ = prefix ;}
+    
     // Set the name of the configuration file option
     void SetConfigFileOption(const std::string& new_configfile_opt)
     {configfile_opt_name = new_configfile_opt ;}
+    const std::string& GetConfigFileOption() const
+    {return configfile_opt_name ;}
     
+    // Set the value of a parameter from text. By default this is treated as
+    // an override, so it takes precedence over every other source. Returns
+    // false if the parameter doesnt exist or the value isnt valid.
     bool SetParam(const std::string& param_name,
-                  std::vector<std::string> param_value) ;
+                  std::vector<std::string> param_value,
+                  CLSource source = CL_SOURCE_OVERRIDE) ;
+    bool SetOverride(const std::string& param_name, const std::string& value)
+    {return SetParam(param_name, std::vector<std::string>(1, value), CL_SOURCE_OVERRIDE) ;}
+    
+    // Get where the current value of a parameter came from
+    CLSource GetSource(const std::string& param_name) const ;
+    
+    // Print the 'max_params' parameters that have been looked up by name
+    // (with 'As*' or '[]') most often. Parameters looked up very often are
+    // better read through the handle returned by 'Add*Param'. The counts
+    // are only collected when compiled with CLOPT_ENABLE_PROFILING.
+    void PrintAccessReport(size_t max_params = 10) const ;
+    // Number of times a parameter has been looked up by name
+    uint64_t GetAccessCount(const std::string& param_name) const ;
+    
+    // Get the time spent in the last call to 'ParseCommandLine' (only
+    // collected when compiled with CLOPT_ENABLE_STATS)
+    const CLParseStats& GetParseStats() const {return parse_stats_ ;}
     
 protected:
     // The variable used for storing the parameters
     std::vector<struct option> longopts ;
     
-    // Storage objects for the different parameter types
-    std::map<std::string, CLBool*>   params_bools ;
-    std::map<std::string, CLDouble*> params_doubles ;
-    std::map<std::string, CLInt*>    params_ints ;
-    std::map<std::string, CLString*> params_strings ;
+    // Storage for the parameters of all types
+    CLParamRegistry params_ ;
+    
+    // Storage for the parameter objects themselves
+    CLParamArena params_arena_ ;
+    
+    // Register a new parameter, replacing any with the same name
+    void AddParam(CLParamType type, CLParamBase* param)
+    {
+        // A global parameter replaced by a subcommand is kept, so that it
+        // can be put back when the subcommand is dropped
+        if (!subcommand_.empty()) {
+            const CLParamRegistry::Entry* entry = params_.Find(param->getParamName()) ;
+            size_t index = (entry != 0) ? size_t(entry - &params_.Entries()[0]) : 0 ;
+            if ((entry != 0) && (index < global_param_count_) && !IsShadowed(index)) {
+                shadowed_.push_back(std::make_pair(index, *entry)) ;
+                params_.Insert(type, param) ;
+                help_cache_valid_ = false ;
+                tables_valid_ = false ;
+                return ;
+            }
+        }
+        CLParamBase* old_param = params_.Insert(type, param) ;
+        if (old_param != 0) params_arena_.Destroy(old_param) ;
+        help_cache_valid_ = false ;
+        tables_valid_ = false ;
+    }
+    
+    // Render the help text into 'out', wrapping the descriptions at 'width'
+    void RenderHelp(const std::string& executable_name, size_t width,
+                    std::string& out) const ;
+    static void AppendDescription(std::string& out,
+                                  const std::string& param_description,
+                                  int left_padding, size_t width) ;
+    
+    // Help text from the last call to 'PrintHelp'
+    std::string help_cache_ ;
+    std::string help_cache_name_ ;
+    size_t      help_cache_width_ = 0 ;
+    bool        help_cache_valid_ = false ;
 
     std::string help_str    = "help";
     std::string version_str = "version";
     
     // This method puts together the full list of parameters into
-    // the longopts vector so that it can be used by getopt
+    // the longopts vector, for code passing them to getopt directly
+    // (ParseCommandLine uses the lookup tables below instead)
     void DefineParams() ;
     struct option DefineOptSingle(const std::string& name, int has_arg, int *flag, char val) ;
     
+    // Lookup tables used when parsing, which are only built again after
+    // an option has been added rather than on every parse. The ids are
+    // the indices of the parameters in 'params_', apart from the help
+    // and version options. Note that the tables hold no pointers, so they
+    // stay valid when the options are moved or cloned.
+    enum {HELP_OPTION_ID = -3, VERSION_OPTION_ID = -4} ;
+    CLNameIndex      long_names_ ;   // Long option names
+    std::vector<int> short_ids_ ;    // Id of each short option character (or NO_MATCH)
+    std::vector<std::pair<std::string, int> > env_names_ ;  // Sorted names in the environment
+                                                             // (without the prefix) and ids
+    bool             tables_valid_ = false ;
+    void BuildTables() ;
+    
+    // Returns the id of the option matching 'name', allowing unambiguous
+    // abbreviations (or NO_MATCH or AMBIGUOUS_MATCH, see CLNameIndex)
+    int MatchLongOpt(const char* name, size_t name_len) const
+    {return long_names_.Match(name, name_len) ;}
+    
+    // Returns the registered name closest to a misspelt one (or an empty
+    // string if none is close), optionally including 'help' and 'version'
+    std::string SuggestName(const char* name, size_t name_len, bool with_builtin) const ;
+    
+    // Set a parameter from text, printing an error if the text isnt valid.
+    // Values from a lower source than the current one are ignored.
+    CLConvertStatus SetParamValue(const CLParamRegistry::Entry& entry,
+                                  const char* value, size_t value_len,
+                                  CLSource source) ;
+    
     
     // Fill the options from a configuration file
     bool FillFromFile(const std::string& filename) ;
@@ -452,11 +2351,45 @@ protected:
     // Default configuration file option name
     std::string configfile_opt_name ;
     std::string configfile_comment ;  // Lines in the config file beginning with this will be ignored
+    std::string env_prefix_ ;         // Prefix of the environment variables to read
+    bool        lazy_conversion_ = false ;  // Whether to delay converting values
+    bool        map_config_files_ = true ;  // Whether to mmap configuration files
+    
+    // Statistics about the last parse (see CLOPT_ENABLE_STATS)
+    CLParseStats parse_stats_ ;
     CLString version_opt ;
     
     // Stores a string containing the description of this program
     std::string program_desc_ = std::string() ;
     
+    // Subcommands, sorted by name
+    struct Subcommand {
+        std::string description ;
+        std::function<void(CLOptions&)> factory ;
+    } ;
+    std::map<std::string, Subcommand> subcommands_ ;
+    std::string subcommand_ ;         // Selected subcommand
+    
+    // Everything added once a subcommand is selected comes after these in
+    // 'params_' and 'params_arena_', so dropping the subcommand only has
+    // to put back the global parameters it replaced ('shadowed_')
+    size_t              global_param_count_ = 0 ;
+    CLParamArena::Mark  global_arena_mark_ = CLParamArena::Mark() ;
+    std::vector<std::pair<size_t, CLParamRegistry::Entry> > shadowed_ ;
+    bool IsShadowed(size_t index) const
+    {
+        for (size_t i=0; i<shadowed_.size(); i++) {
+            if (shadowed_[i].first == index) return true ;
+        }
+        return false ;
+    }
+    
+    // Select a subcommand and add its parameters. Returns true if there
+    // is no subcommand with this name.
+    bool SelectSubcommand(const std::string& name) ;
+    // Remove the parameters of the selected subcommand (if any)
+    void DropSubcommand() ;
+    
 private:
     
 };
@@ -468,101 +2401,312 @@ private:
  * More complicated method definitions
  ***************************************/
 //__________________________________________________________
-bool CLOptions::ParseCommandLine(int argc, char** argv)
+CLOptions CLOptions::Clone() const
 {
-    // Establish the actual parameters
-    DefineParams() ;
+    CLOptions clone ;
+    clone.help_str            = help_str ;
+    clone.version_str         = version_str ;
+    clone.configfile_opt_name = configfile_opt_name ;
+    clone.configfile_comment  = configfile_comment ;
+    clone.version_opt         = version_opt ;
+    clone.program_desc_       = program_desc_ ;
+    clone.env_prefix_         = env_prefix_ ;
+    clone.lazy_conversion_    = lazy_conversion_ ;
+    clone.map_config_files_   = map_config_files_ ;
+    clone.subcommands_        = subcommands_ ;
+    clone.subcommand_         = subcommand_ ;
+    clone.long_names_         = long_names_ ;
+    clone.short_ids_          = short_ids_ ;
+    clone.env_names_          = env_names_ ;
+    clone.tables_valid_   = tables_valid_ ;
+    clone.global_param_count_ = global_param_count_ ;
+    clone.shadowed_           = shadowed_ ;
+    
+    // Copy the registry as is (avoiding rehashing every name) and then
+    // point it at copies of the parameters. The parameters of the
+    // subcommand are copied last, so that they can be dropped in the
+    // clone too.
+    clone.params_ = params_ ;
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    size_t n_global = subcommand_.empty() ? entries.size() : global_param_count_ ;
+    for (size_t i=0; i<clone.shadowed_.size(); i++) {
+        CLParamRegistry::Entry& entry = clone.shadowed_[i].second ;
+        entry.param = entry.param->clone(clone.params_arena_) ;
+    }
+    for (size_t i=0; i<n_global; i++) {
+        if (IsShadowed(i)) continue ;
+        clone.params_.SetEntryParam(i, entries[i].param->clone(clone.params_arena_)) ;
+    }
+    clone.global_arena_mark_ = clone.params_arena_.GetMark() ;
+    for (size_t i=0; i<entries.size(); i++) {
+        if ((i < n_global) && !IsShadowed(i)) continue ;
+        clone.params_.SetEntryParam(i, entries[i].param->clone(clone.params_arena_)) ;
+    }
+    
+    return clone ;
+}
 
-    // If we've defined a configuration file parameter, do a pre-loop to see if
-    // the user has passed that parameter
-    if (configfile_opt_name.size() > 0) {
-        // Loop until we find the config file name
-        bool use_default_configfile(true) ;
-        while(1) {
-            int c(0), options_index(-1) ;
-            
-            c = getopt_long_only(argc, argv, "",
-                                 &longopts[0], &options_index) ;
-            if (c==-1) break;
-            if (c==0) continue ;
-            if (std::string(longopts[options_index].name).compare(configfile_opt_name)==0) {
-                if (FillFromFile(optarg)) return true ;
-                use_default_configfile = false ;
-                break ;
+//__________________________________________________________
+// Note that all of the parsing state lives either on the stack or inside
+// this object, so separate CLOptions objects can be parsed concurrently
+// from different threads (unlike getopt, which relies on 'optind' and
+// 'optarg' globals).
+bool CLOptions::ParseCommandLine(int argc, char** argv)
+{
+    CLOPT_STATS_RESET() ;
+    CLOPT_STATS_SCOPE(total_ns) ;
+    
+    // Only the global options can come before the subcommand, so forget
+    // any subcommand selected by a previous parse
+    DropSubcommand() ;
+    
+    // Establish the actual parameters (if any have been added)
+    BuildTables() ;
+    
+    // Options are collected in a single pass over argv and then merged with
+    // the other sources. Every value records where it came from, and is only
+    // replaced by values from the same or a higher source, so that
+    //    defaults < config file < environment < command line < overrides
+    // Note that the values are kept as pointers into argv rather than copied,
+    // and the parameters by their index (a subcommand may add parameters).
+    std::vector<std::pair<size_t, const char*> > passed_opts ;
+    passed_opts.reserve(argc) ;
+    const char* configfile = 0 ;
+    bool found_subcommand = false ;
+    
+    CLOPT_STATS_START(scan_start) ;
+    for (int i=1; i<argc; i++) {
+        const char* arg = argv[i] ;
+        
+        // Skip anything that isnt an option (i.e. positional arguments),
+        // unless it's the first one and selects the subcommand. The options
+        // of the subcommand are only known after this.
+        if ((arg[0] != '-') || (arg[1] == '\0')) {
+            if (!subcommands_.empty() && !found_subcommand) {
+                if (SelectSubcommand(arg)) return true ;
+                found_subcommand = true ;
             }
+            continue ;
         }
-        // If the config file info wasnt filled AND if the default filename isnt empty
-        // fill the config options from the default file
-        if ((use_default_configfile)&&(!(*this)[configfile_opt_name].empty())) {
-            if (FillFromFile((*this)[configfile_opt_name])) return true ;
-        }
-    }
-    
-    // Reset the option index so that we can start over filling the options
-    // that were passed on the command line
-    optind = 0 ;
-    
-    std::string short_opts ;
-    std::map<int, std::string> short_to_long_map = GetShortOpts(short_opts) ;
-
-    // Loop through all the passed options
-    while (1)
-    {
-        int c(0) ;
-
-        /* getopt_long stores the option index here. */
-        int option_index = -1;
-                
-        // If short form options were given, then enforce the "double-dash" policy
-        // for long options
-        c = getopt_long (argc, argv, short_opts.c_str(),
-                         &longopts[0], &option_index);
         
-        /* Detect the end of the options. */
-        if (c == -1) break;
+        // '--' marks the end of the options
+        if ((arg[1] == '-') && (arg[2] == '\0')) break ;
         
-        // Now loop through all of the options to fill them based on their values
-        switch (c)
-        {
-            case 0:
-                /* If this option set a flag, do nothing else now. */
-                break;
-            case 'h':
-                // Print the help message and quit
-                PrintHelp(argv[0]) ;
-                return true ;
-            case 'v':
-                // Print the version information
-                PrintDescription(version_opt.getValue(), 0) ;
+        if (arg[1] == '-') {
+            // Long form of the option: '--name value' or '--name=value'
+            const char* name = arg + 2 ;
+            const char* value = std::strchr(name, '=') ;
+            size_t name_len = (value != 0) ? size_t(value - name) : std::strlen(name) ;
+            
+            int id = MatchLongOpt(name, name_len) ;
+            if (id == CLNameIndex::NO_MATCH) {
+                std::string suggestion = SuggestName(name, name_len, true) ;
+                CLOptionsHelper::errors() << "[ERROR] CLOptions::ParseCommandLine() :: unrecognized option '" << arg << "'" ;
+                if (!suggestion.empty()) CLOptionsHelper::errors() << "; did you mean '--" << suggestion << "'?" ;
+                CLOptionsHelper::errors() << std::endl;
                 return true ;
-            case '?':
-                // getopt_long already printed an error message. This will
-                // most typically happen when an unrecognized option has 
-                // been passed, or when an option expecting an argument 
-                // was not given one on the commandline.
+            } else if (id == CLNameIndex::AMBIGUOUS_MATCH) {
+                CLOptionsHelper::errors() << "[ERROR] CLOptions::ParseCommandLine() :: option '" << arg << "' is ambiguous; possibilities:" ;
+                std::vector<std::string> candidates = long_names_.Candidates(name, name_len) ;
+                for (size_t j=0; j<candidates.size(); j++) CLOptionsHelper::errors() << " '--" << candidates[j] << "'" ;
+                CLOptionsHelper::errors() << std::endl;
                 return true ;
-            default:
-                // We have found an option, so get the option name
-                std::string opt_name ;
-                if (option_index >= 0) {
-                    // The long form of the name was supplied
-                    opt_name = longopts[option_index].name ;
+            }
+            
+            // Only 'help' and 'version' take no argument
+            if ((id == HELP_OPTION_ID) || (id == VERSION_OPTION_ID)) {
+                if (value != 0) {
+                    CLOptionsHelper::errors() << "[ERROR] CLOptions::ParseCommandLine() :: option '--"
+                              << ((id == HELP_OPTION_ID) ? help_str : version_str) << "' doesn't allow an argument" << std::endl;
+                    return true ;
+                }
+                if (id == HELP_OPTION_ID) {
+                    PrintHelp(argv[0]) ;
                 } else {
-                    // The short form of the name was supplied
-                    char c_char(c) ;
-                    opt_name = short_to_long_map[c_char] ;
+                    PrintDescription(version_opt.getValue(), 0) ;
+                }
+                return true ;
+            }
+            
+            // Get the value from the next argument if it wasnt attached
+            const CLParamRegistry::Entry* entry = &params_.Entries()[id] ;
+            if (value != 0) {
+                value++ ;
+            } else if (i+1 < argc) {
+                value = argv[++i] ;
+            } else {
+                CLOptionsHelper::errors() << "[ERROR] CLOptions::ParseCommandLine() :: option '--" << entry->name << "' requires an argument" << std::endl;
+                return true ;
+            }
+            
+            // Only the first configuration file passed is used
+            if ((configfile == 0) && (configfile_opt_name == entry->name)) {
+                configfile = value ;
+            }
+            passed_opts.push_back(std::make_pair(size_t(entry - &params_.Entries()[0]), value)) ;
+        } else {
+            // Short form of the option(s): '-x value', '-xvalue' or '-hv'
+            for (const char* c=arg+1; *c!='\0'; c++) {
+                int id = short_ids_[(unsigned char)*c] ;
+                if (id == CLNameIndex::NO_MATCH) {
+                    CLOptionsHelper::errors() << "[ERROR] CLOptions::ParseCommandLine() :: invalid option -- '" << *c << "'" << std::endl;
+                    return true ;
+                } else if (id == HELP_OPTION_ID) {
+                    PrintHelp(argv[0]) ;
+                    return true ;
+                } else if (id == VERSION_OPTION_ID) {
+                    PrintDescription(version_opt.getValue(), 0) ;
+                    return true ;
+                }
+                
+                // Everything else requires an argument
+                const char* value = c + 1 ;
+                if (*value == '\0') {
+                    if (i+1 >= argc) {
+                        CLOptionsHelper::errors() << "[ERROR] CLOptions::ParseCommandLine() :: option requires an argument -- '" << *c << "'" << std::endl;
+                        return true ;
+                    }
+                    value = argv[++i] ;
                 }
-                std::string opt_val ( optarg ) ;
-                std::vector<std::string> values = CLOptionsHelper::split( optarg, ' ') ;
-                SetParam(opt_name, values) ;
                 
+                const CLParamRegistry::Entry* entry = &params_.Entries()[id] ;
+                if ((configfile == 0) && (configfile_opt_name == entry->name)) {
+                    configfile = value ;
+                }
+                passed_opts.push_back(std::make_pair(size_t(entry - &params_.Entries()[0]), value)) ;
                 break ;
+            }
+        }
+    }
+    
+    CLOPT_STATS_STOP(scan_start, scan_ns) ;
+    CLOPT_STATS_ADD(options_seen, passed_opts.size()) ;
+    
+    // Read the environment first, since it may name the configuration file
+    if (!env_prefix_.empty()) {
+        if (FillFromEnvironment(env_prefix_)) return true ;
+    }
+    
+    // If we've defined a configuration file parameter, fill the options from
+    // the file passed by the user or, failing that, from the default file
+    if (configfile_opt_name.size() > 0) {
+        if (configfile != 0) {
+            if (FillFromFile(configfile)) return true ;
+        } else if (!(*this)[configfile_opt_name].empty()) {
+            if (FillFromFile((*this)[configfile_opt_name])) return true ;
         }
     }
+    
+    // Now fill the options that were passed on the command line, converting
+    // the values directly from argv. Only the text up to the first space
+    // is used as the value (except for lists, which use all of it).
+    CLOPT_STATS_SCOPE(command_line_ns) ;
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    for (size_t i=0; i<passed_opts.size(); i++) {
+        const CLParamRegistry::Entry& entry = entries[passed_opts[i].first] ;
+        const char* value = passed_opts[i].second ;
+        size_t value_len = CLIsListType(entry.type) ?
+                           std::strlen(value) : std::strcspn(value, " ") ;
+        if (SetParamValue(entry, value, value_len, CL_SOURCE_COMMANDLINE) != CL_CONVERT_OK) return true ;
+    }
+    
     // Note that it is up to the user to handle conflicts between parameters
     return false ;
 }
 
+//__________________________________________________________
+bool CLOptions::SelectSubcommand(const std::string& name)
+{
+    std::map<std::string, Subcommand>::const_iterator subcommand = subcommands_.find(name) ;
+    if (subcommand == subcommands_.end()) {
+        CLOptionsHelper::Suggestion suggestion(name.data(), name.size()) ;
+        for (subcommand = subcommands_.begin(); subcommand != subcommands_.end(); ++subcommand) {
+            suggestion.Check(subcommand->first) ;
+        }
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::ParseCommandLine() :: unknown command '" << name << "'" ;
+        if (!suggestion.Best().empty()) CLOptionsHelper::errors() << "; did you mean '" << suggestion.Best() << "'?" ;
+        CLOptionsHelper::errors() << std::endl;
+        return true ;
+    }
+    
+    global_param_count_ = params_.size() ;
+    global_arena_mark_  = params_arena_.GetMark() ;
+    subcommand_ = name ;
+    if (subcommand->second.factory) subcommand->second.factory(*this) ;
+    BuildTables() ;
+    help_cache_valid_ = false ;
+    return false ;
+}
+
+//__________________________________________________________
+void CLOptions::DropSubcommand()
+{
+    if (subcommand_.empty()) return ;
+    
+    // Put back the global parameters first, since the ones replacing them
+    // are destroyed along with the rest of the subcommand
+    for (size_t i=0; i<shadowed_.size(); i++) params_.SetEntry(shadowed_[i].first, shadowed_[i].second) ;
+    shadowed_.clear() ;
+    params_.Truncate(global_param_count_) ;
+    params_arena_.Rewind(global_arena_mark_) ;
+    
+    subcommand_.clear() ;
+    help_cache_valid_ = false ;
+    tables_valid_ = false ;
+}
+
+//__________________________________________________________
+void CLOptions::BuildTables()
+{
+    if (tables_valid_) return ;
+    CLOPT_STATS_SCOPE(define_params_ns) ;
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    
+    long_names_.Clear() ;
+    long_names_.Add(help_str, HELP_OPTION_ID) ;
+    if (!version_opt.getParamName().empty()) long_names_.Add(version_str, VERSION_OPTION_ID) ;
+    for (size_t i=0; i<entries.size(); i++) long_names_.Add(entries[i].name, int(i)) ;
+    long_names_.Sort() ;
+    
+    // Help and version take precedence over parameters with the same
+    // short name (':' is never a valid option)
+    short_ids_.assign(256, CLNameIndex::NO_MATCH) ;
+    for (size_t i=0; i<entries.size(); i++) {
+        char short_name = entries[i].param->getShortParamName() ;
+        if ((short_name > 10) && (short_name != ':')) short_ids_[(unsigned char)short_name] = int(i) ;
+    }
+    short_ids_['h'] = HELP_OPTION_ID ;
+    if (!version_opt.getValue().empty()) short_ids_['v'] = VERSION_OPTION_ID ;
+    
+    // Names in the environment are in upper case with '_' instead of '-',
+    // so different parameters can end up with the same one
+    env_names_.resize(entries.size()) ;
+    for (size_t i=0; i<entries.size(); i++) {
+        std::string& env_name = env_names_[i].first ;
+        env_name = entries[i].name ;
+        for (size_t c=0; c<env_name.size(); c++) {
+            env_name[c] = (env_name[c] == '-') ? '_' : char(std::toupper((unsigned char)env_name[c])) ;
+        }
+        env_names_[i].second = int(i) ;
+    }
+    std::sort(env_names_.begin(), env_names_.end()) ;
+    
+    tables_valid_ = true ;
+}
+
+//__________________________________________________________
+std::string CLOptions::SuggestName(const char* name, size_t name_len, bool with_builtin) const
+{
+    CLOptionsHelper::Suggestion suggestion(name, name_len) ;
+    if (with_builtin) {
+        suggestion.Check(help_str) ;
+        if (!version_opt.getParamName().empty()) suggestion.Check(version_str) ;
+    }
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    for (size_t i=0; i<entries.size(); i++) suggestion.Check(entries[i].name) ;
+    return suggestion.Best() ;
+}
+
 //__________________________________________________________
 std::map<int, std::string> CLOptions::GetShortOpts(std::string& short_opts)
 {
@@ -572,35 +2716,11 @@ std::map<int, std::string> CLOptions::GetShortOpts(std::string& short_opts)
     // Create a map of "short" -> "long" variables
     std::map<int,std::string> short_to_long ;
     
-    std::map<std::string, CLBool*>::iterator bool_itr ;
-    for (bool_itr=params_bools.begin(); bool_itr!=params_bools.end(); ++bool_itr) {
-        if (bool_itr->second->getShortParamName() > 10) {
-            short_opts += bool_itr->second->getShortParamNameStr()+":";
-            short_to_long[bool_itr->second->getShortParamName()] = bool_itr->second->getParamName() ;
-        }
-    }
-    // DOUBLES
-    std::map<std::string, CLDouble*>::iterator dbl_itr ;
-    for (dbl_itr=params_doubles.begin(); dbl_itr!=params_doubles.end(); ++dbl_itr) {
-        if (dbl_itr->second->getShortParamName() > 10) {
-            short_opts += dbl_itr->second->getShortParamNameStr()+":";
-            short_to_long[dbl_itr->second->getShortParamName()] = dbl_itr->second->getParamName() ;
-        }
-    }
-    // INTEGERS
-    std::map<std::string, CLInt*>::iterator int_itr ;
-    for (int_itr=params_ints.begin(); int_itr!=params_ints.end(); ++int_itr) {
-        if (int_itr->second->getShortParamName() > 10) {
-            short_opts += int_itr->second->getShortParamNameStr()+":";
-            short_to_long[int_itr->second->getShortParamName()] = int_itr->second->getParamName() ;
-        }
-    }
-    // STRINGS
-    std::map<std::string, CLString*>::iterator str_itr ;
-    for (str_itr=params_strings.begin(); str_itr!=params_strings.end(); ++str_itr) {
-        if (str_itr->second->getShortParamName() > 10) {
-            short_opts += str_itr->second->getShortParamNameStr()+":";
-            short_to_long[str_itr->second->getShortParamName()] = str_itr->second->getParamName() ;
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    for (size_t i=0; i<entries.size(); i++) {
+        if (entries[i].param->getShortParamName() > 10) {
+            short_opts += entries[i].param->getShortParamNameStr()+":";
+            short_to_long[entries[i].param->getShortParamName()] = entries[i].name ;
         }
     }
     
@@ -611,146 +2731,278 @@ std::map<int, std::string> CLOptions::GetShortOpts(std::string& short_opts)
 // Note that the vector-ness of 'opt_vals' will allow for passing
 // values to options which take a list of values
 bool CLOptions::SetParam(const std::string& opt_name,
-                         std::vector<std::string> opt_vals)
+                         std::vector<std::string> opt_vals,
+                         CLSource source)
 {
     // Special check for the version parameter
     
     
     // Fill in the correct variable
-    if (params_bools.count(opt_name) > 0) {
-        *params_bools[opt_name] = opt_vals.front() ;
-    } else if (params_doubles.count(opt_name) > 0) {
-        *params_doubles[opt_name] = opt_vals.front() ;
-    } else if (params_ints.count(opt_name) > 0) {
-        *params_ints[opt_name] = opt_vals.front() ;
-    } else if (params_strings.count(opt_name) > 0) {
-        *params_strings[opt_name] = opt_vals.front() ;
-    } else {
-        return false ;
+    const CLParamRegistry::Entry* entry = params_.Find(opt_name) ;
+    if (entry == 0) return false ;
+    
+    // Lists take all of the values
+    if (CLIsListType(entry->type) && (opt_vals.size() > 1)) {
+        std::string all_vals = opt_vals.front() ;
+        for (size_t i=1; i<opt_vals.size(); i++) all_vals += " " + opt_vals[i] ;
+        return (SetParamValue(*entry, all_vals.data(), all_vals.size(), source) == CL_CONVERT_OK) ;
     }
     
-    return true ;
+    CLConvertStatus status = opt_vals.empty() ?
+                             SetParamValue(*entry, "", 0, source) :
+                             SetParamValue(*entry, opt_vals.front().data(), opt_vals.front().size(), source) ;
+    return (status == CL_CONVERT_OK) ;
 }
 
 //__________________________________________________________
-std::string CLOptions::operator[](std::string param_name)
+CLConvertStatus CLOptions::SetParamValue(const CLParamRegistry::Entry& entry,
+                                         const char* value, size_t value_len,
+                                         CLSource source)
 {
-    // Create a default return value of an empty string
-    std::stringstream param_val ;
-    
-    // Loop through the bools
-    if (params_bools.count(param_name) > 0) {
-        param_val << params_bools[param_name]->getValue() ;
-    }
-    
-    // Loop through the doubles
-    else if (params_doubles.count(param_name) > 0) {
-        param_val << params_doubles[param_name]->getValue() ;
-    }
-    
-    // Loop through the ints
-    else if (params_ints.count(param_name) > 0) {
-        param_val << params_ints[param_name]->getValue() ;
-    }
-    
-    // Loop through the strings
-    else if (params_strings.count(param_name) > 0) {
-        param_val << params_strings[param_name]->getValue() ;
+    // Leave values that came from a higher source alone
+    if (source < entry.param->getSource()) return CL_CONVERT_OK ;
+    
+    // In lazy mode just keep the text until the value is needed
+    if (lazy_conversion_ && entry.param->setPending(value, value_len)) {
+        entry.param->setSource(source) ;
+        return CL_CONVERT_OK ;
+    }
+    
+    CLOPT_STATS_START(convert_start) ;
+    CLConvertStatus status = entry.param->setFromString(value, value_len) ;
+    CLOPT_STATS_STOP(convert_start, conversion_ns) ;
+    CLOPT_STATS_ADD(conversions, 1) ;
+    if (status == CL_CONVERT_OK) {
+        // Render the text straight away, so that parsed options can be
+        // read from several threads without modifying them
+        entry.param->setSource(source) ;
+        entry.param->updateValueStr() ;
+    } else {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::SetParam() :: Invalid value \"" ;
+        CLOptionsHelper::errors().write(value, value_len) ;
+        CLOptionsHelper::errors() << "\" for parameter \"" << entry.name << "\" ("
+                  << CLOptionsHelper::convert_error(status) << ")" << std::endl;
+        CLOPT_STATS_ADD(conversion_errors, 1) ;
     }
-    
-    else {
-        std::cerr << "[ERROR] Unknown command line parameter: " << param_name << std::endl;
+    return status ;
+}
+
+//__________________________________________________________
+const std::string& CLOptions::operator[](const std::string& param_name) const
+{
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    CLOPT_PROFILE_ACCESS(entry) ;
+    if (entry == 0) {
+        CLOptionsHelper::errors() << "[ERROR] Unknown command line parameter: " << param_name << std::endl;
+        return CLOptionsHelper::empty_string() ;
     }
     
-    return param_val.str() ;
+    return entry->param->getValueStr() ;
 }
 
 //__________________________________________________________
-bool CLOptions::AsBool(const std::string& param_name)
+bool CLOptions::AsBool(const std::string& param_name) const
 {
-    if (params_bools.count(param_name) == 0) {
-        std::cerr << "[ERROR] CLOptions::AsBool() :: Parameter \"" << param_name << "\" is not a bool!" << std::endl;
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    CLOPT_PROFILE_ACCESS(entry) ;
+    if ((entry == 0) || (entry->type != CL_BOOL)) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::AsBool() :: Parameter \"" << param_name << "\" is not a bool!" << std::endl;
         return false ;
     } else {
-        return params_bools[param_name]->getValue();
+        return static_cast<const CLBool*>(entry->param)->getValue();
     }
 }
 
 //__________________________________________________________
-double CLOptions::AsDouble(const std::string& param_name)
+double CLOptions::AsDouble(const std::string& param_name) const
 {
-    if (params_doubles.count(param_name) == 0) {
-        std::cerr << "[ERROR] CLOptions::AsDouble() :: Parameter \"" << param_name << "\" is not a double!" << std::endl;
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    CLOPT_PROFILE_ACCESS(entry) ;
+    if ((entry == 0) || (entry->type != CL_DOUBLE)) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::AsDouble() :: Parameter \"" << param_name << "\" is not a double!" << std::endl;
         return 0 ;
     } else {
-        return params_doubles[param_name]->getValue();
+        return static_cast<const CLDouble*>(entry->param)->getValue();
     }
 }
 
 //__________________________________________________________
-int CLOptions::AsInt(const std::string& param_name)
+int CLOptions::AsInt(const std::string& param_name) const
 {
-    if (params_ints.count(param_name) == 0) {
-        std::cerr << "[ERROR] CLOptions::AsInt() :: Parameter \"" << param_name << "\" is not an integer!" << std::endl;
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    CLOPT_PROFILE_ACCESS(entry) ;
+    if ((entry == 0) || (entry->type != CL_INT)) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::AsInt() :: Parameter \"" << param_name << "\" is not an integer!" << std::endl;
         return 0 ;
     } else {
-        return params_ints[param_name]->getValue();
+        return static_cast<const CLInt*>(entry->param)->getValue();
     }
 }
 
 //__________________________________________________________
-std::string CLOptions::AsString(const std::string& param_name)
+const std::string& CLOptions::AsString(const std::string& param_name) const
 {
-    if (params_strings.count(param_name) == 0) {
-        std::cerr << "[ERROR] CLOptions::AsString() :: Parameter \"" << param_name << "\" is not a string!" << std::endl;
-        return 0 ;
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    CLOPT_PROFILE_ACCESS(entry) ;
+    if ((entry == 0) || (entry->type != CL_STRING)) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::AsString() :: Parameter \"" << param_name << "\" is not a string!" << std::endl;
+        return CLOptionsHelper::empty_string() ;
     } else {
-        return params_strings[param_name]->getValue();
+        return static_cast<const CLString*>(entry->param)->getValueRef();
     }
 }
 
 //__________________________________________________________
-bool CLOptions::HasPar(const std::string& param_name)
+const std::vector<int>& CLOptions::AsIntList(const std::string& param_name) const
 {
-    bool par_exists = false;
-    // Check if any of the maps has the parameter
-    if ((params_bools.count(param_name) > 0) ||
-        (params_doubles.count(param_name) > 0) ||
-        (params_ints.count(param_name) > 0) ||
-        (params_strings.count(param_name) > 0)) {
-        
-        // The parameter exists
-        par_exists = true;
+    static const std::vector<int> empty_list ;
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    CLOPT_PROFILE_ACCESS(entry) ;
+    if ((entry == 0) || (entry->type != CL_INT_LIST)) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::AsIntList() :: Parameter \"" << param_name << "\" is not a integer list!" << std::endl;
+        return empty_list ;
+    } else {
+        return static_cast<const CLList<int>*>(entry->param)->getValueRef();
+    }
+}
+
+//__________________________________________________________
+const std::vector<double>& CLOptions::AsDoubleList(const std::string& param_name) const
+{
+    static const std::vector<double> empty_list ;
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    CLOPT_PROFILE_ACCESS(entry) ;
+    if ((entry == 0) || (entry->type != CL_DOUBLE_LIST)) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::AsDoubleList() :: Parameter \"" << param_name << "\" is not a double list!" << std::endl;
+        return empty_list ;
+    } else {
+        return static_cast<const CLList<double>*>(entry->param)->getValueRef();
     }
+}
+
+//__________________________________________________________
+const std::vector<std::string>& CLOptions::AsStringList(const std::string& param_name) const
+{
+    static const std::vector<std::string> empty_list ;
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    CLOPT_PROFILE_ACCESS(entry) ;
+    if ((entry == 0) || (entry->type != CL_STRING_LIST)) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::AsStringList() :: Parameter \"" << param_name << "\" is not a string list!" << std::endl;
+        return empty_list ;
+    } else {
+        return static_cast<const CLList<std::string>*>(entry->param)->getValueRef();
+    }
+}
+
+//__________________________________________________________
+bool CLOptions::HasPar(const std::string& param_name) const
+{
+    return (params_.Find(param_name) != 0) ;
+}
+
+//__________________________________________________________
+bool CLOptions::ConvertPending()
+{
+    bool error = false ;
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    for (size_t i=0; i<entries.size(); i++) {
+        // Note that this also returns the cached result of values that
+        // were already converted
+        if (entries[i].param->resolvePending() != CL_CONVERT_OK) error = true ;
+    }
+    return error ;
+}
+
+//__________________________________________________________
+void CLOptions::Reset()
+{
+    DropSubcommand() ;
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    for (size_t i=0; i<entries.size(); i++) entries[i].param->resetToDefault() ;
+}
+
+//__________________________________________________________
+uint64_t CLOptions::GetAccessCount(const std::string& param_name) const
+{
+#ifdef CLOPT_ENABLE_PROFILING
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    if (entry != 0) return entry->param->getAccessCount() ;
+#else
+    (void)param_name ;
+#endif
+    return 0 ;
+}
+
+//__________________________________________________________
+void CLOptions::PrintAccessReport(size_t max_params) const
+{
+#ifdef CLOPT_ENABLE_PROFILING
+    // Sort the parameters that have been used by their number of lookups
+    std::vector<std::pair<uint64_t, const CLParamRegistry::Entry*> > counts ;
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    for (size_t i=0; i<entries.size(); i++) {
+        uint64_t count = entries[i].param->getAccessCount() ;
+        if (count > 0) counts.push_back(std::make_pair(count, &entries[i])) ;
+    }
+    std::sort(counts.begin(), counts.end(),
+              [](const std::pair<uint64_t, const CLParamRegistry::Entry*>& a,
+                 const std::pair<uint64_t, const CLParamRegistry::Entry*>& b) {
+                  return (a.first != b.first) ? (a.first > b.first) : (a.second->name < b.second->name) ;
+              }) ;
+    
+    std::printf("Most frequent parameter lookups:\n") ;
+    std::printf("  %14s  %-12s %s\n", "lookups", "type", "parameter") ;
+    for (size_t i=0; (i<counts.size()) && (i<max_params); i++) {
+        std::printf("  %14llu  %-12s %s\n", (unsigned long long)counts[i].first,
+                    CLTypeName(counts[i].second->type), counts[i].second->name.c_str()) ;
+    }
+#else
+    (void)max_params ;
+    std::printf("Parameter lookups are only counted when compiled with CLOPT_ENABLE_PROFILING\n") ;
+#endif
+}
 
-    return par_exists;
+//__________________________________________________________
+CLSource CLOptions::GetSource(const std::string& param_name) const
+{
+    const CLParamRegistry::Entry* entry = params_.Find(param_name) ;
+    if (entry == 0) {
+        CLOptionsHelper::errors() << "[ERROR] Unknown command line parameter: " << param_name << std::endl;
+        return CL_SOURCE_DEFAULT ;
+    }
+    // A value that cant be converted keeps its previous source
+    if (entry->param->isPending()) entry->param->resolvePending() ;
+    return entry->param->getSource() ;
 }
 
 //__________________________________________________________
-void CLOptions::PrintDetailed()
+void CLOptions::PrintDetailed() const
 {
     // Print the values of the parameters in detail
     PrintBools(true) ;
     PrintDoubles(true) ;
     PrintInts(true) ;
     PrintStrings(true) ;
+    PrintLists(true) ;
 }
 
 //__________________________________________________________
-void CLOptions::PrintSimple()
+void CLOptions::PrintSimple() const
 {
     // Print the values of the parameters without descriptions
     PrintBools(false) ;
     PrintDoubles(false) ;
     PrintInts(false) ;
     PrintStrings(false) ;
+    PrintLists(false) ;
 }
 
 //__________________________________________________________
-void CLOptions::PrintBools(bool detailed)
+void CLOptions::PrintBools(bool detailed) const
 {
-    // Dont do anything if the map is emtpy
-    if (params_bools.empty()) return ;
+    // Dont do anything if there are no parameters of this type
+    std::vector<const CLParamRegistry::Entry*> params = params_.Sorted(CL_BOOL) ;
+    if (params.empty()) return ;
     
     // Print a parameter header if doing detailed
     if (detailed) {
@@ -760,18 +3012,19 @@ void CLOptions::PrintBools(bool detailed)
     }
     
     // Now loop through each of the parameters
-    std::map<std::string, CLBool*>::iterator iter ;
-    for (iter=params_bools.begin(); iter!=params_bools.end(); ++iter) {
-        if (detailed) {iter->second->Print() ;}
-        else          {iter->second->PrintSimple() ;}
+    for (size_t i=0; i<params.size(); i++) {
+        const CLBool* param = static_cast<const CLBool*>(params[i]->param) ;
+        if (detailed) {param->Print() ;}
+        else          {param->PrintSimple() ;}
     }
 }
 
 //__________________________________________________________
-void CLOptions::PrintDoubles(bool detailed)
+void CLOptions::PrintDoubles(bool detailed) const
 {
-    // Dont do anything if the map is emtpy
-    if (params_doubles.empty()) return ;
+    // Dont do anything if there are no parameters of this type
+    std::vector<const CLParamRegistry::Entry*> params = params_.Sorted(CL_DOUBLE) ;
+    if (params.empty()) return ;
     
     // Print a parameter header if doing detailed
     if (detailed) {
@@ -781,18 +3034,19 @@ void CLOptions::PrintDoubles(bool detailed)
     }
     
     // Now loop through each of the parameters
-    std::map<std::string, CLDouble*>::iterator iter ;
-    for (iter=params_doubles.begin(); iter!=params_doubles.end(); ++iter) {
-        if (detailed) {iter->second->Print() ;}
-        else          {iter->second->PrintSimple() ;}
+    for (size_t i=0; i<params.size(); i++) {
+        const CLDouble* param = static_cast<const CLDouble*>(params[i]->param) ;
+        if (detailed) {param->Print() ;}
+        else          {param->PrintSimple() ;}
     }
 }
 
 //__________________________________________________________
-void CLOptions::PrintInts(bool detailed)
+void CLOptions::PrintInts(bool detailed) const
 {
-    // Dont do anything if the map is emtpy
-    if (params_ints.empty()) return ;
+    // Dont do anything if there are no parameters of this type
+    std::vector<const CLParamRegistry::Entry*> params = params_.Sorted(CL_INT) ;
+    if (params.empty()) return ;
     
     // Print a parameter header if doing detailed
     if (detailed) {
@@ -802,18 +3056,19 @@ void CLOptions::PrintInts(bool detailed)
     }
     
     // Now loop through each of the parameters
-    std::map<std::string, CLInt*>::iterator iter ;
-    for (iter=params_ints.begin(); iter!=params_ints.end(); ++iter) {
-        if (detailed) {iter->second->Print() ;}
-        else          {iter->second->PrintSimple() ;}
+    for (size_t i=0; i<params.size(); i++) {
+        const CLInt* param = static_cast<const CLInt*>(params[i]->param) ;
+        if (detailed) {param->Print() ;}
+        else          {param->PrintSimple() ;}
     }
 }
 
 //__________________________________________________________
-void CLOptions::PrintStrings(bool detailed)
+void CLOptions::PrintStrings(bool detailed) const
 {
-    // Dont do anything if the map is emtpy
-    if (params_strings.empty()) return ;
+    // Dont do anything if there are no parameters of this type
+    std::vector<const CLParamRegistry::Entry*> params = params_.Sorted(CL_STRING) ;
+    if (params.empty()) return ;
     
     // Print a parameter header if doing detailed
     if (detailed) {
@@ -823,110 +3078,217 @@ void CLOptions::PrintStrings(bool detailed)
     }
     
     // Now loop through each of the parameters
-    std::map<std::string, CLString*>::iterator iter ;
-    for (iter=params_strings.begin(); iter!=params_strings.end(); ++iter) {
-        if (detailed) {iter->second->Print() ;}
-        else          {iter->second->PrintSimple() ;}
+    for (size_t i=0; i<params.size(); i++) {
+        const CLString* param = static_cast<const CLString*>(params[i]->param) ;
+        if (detailed) {param->Print() ;}
+        else          {param->PrintSimple() ;}
+    }
+}
+
+//__________________________________________________________
+void CLOptions::PrintLists(bool detailed) const
+{
+    // Collect the lists of all types
+    std::vector<const CLParamRegistry::Entry*> params = params_.Sorted(CL_INT_LIST) ;
+    std::vector<const CLParamRegistry::Entry*> doubles = params_.Sorted(CL_DOUBLE_LIST) ;
+    std::vector<const CLParamRegistry::Entry*> strings = params_.Sorted(CL_STRING_LIST) ;
+    params.insert(params.end(), doubles.begin(), doubles.end()) ;
+    params.insert(params.end(), strings.begin(), strings.end()) ;
+    if (params.empty()) return ;
+    
+    // Print a parameter header if doing detailed
+    if (detailed) {
+        std::printf("*****************\n") ;
+        std::printf("  LISTS\n") ;
+        std::printf("*****************\n") ;
+    }
+    
+    // Now loop through each of the parameters
+    for (size_t i=0; i<params.size(); i++) {
+        if (detailed) {params[i]->param->Print() ;}
+        else          {params[i]->param->PrintSimple() ;}
     }
 }
 
 //__________________________________________________________
 void CLOptions::PrintHelp(const std::string& executable_name)
 {
+    // The help text is rendered once and then reused, unless the parameters,
+    // the executable name or the width of the terminal have changed
+    size_t width = CLOptionsHelper::terminal_width() ;
+    if (!help_cache_valid_ || (help_cache_width_ != width) || (help_cache_name_ != executable_name)) {
+        RenderHelp(executable_name, width, help_cache_) ;
+        help_cache_name_  = executable_name ;
+        help_cache_width_ = width ;
+        help_cache_valid_ = true ;
+    }
+    
+    // Write everything in one go, after anything already printed
+    if (CLOptionsHelper::message_capture() != 0) {
+        CLOptionsHelper::message_capture()->write(help_cache_.data(), help_cache_.size()) ;
+        return ;
+    }
+    std::cout.flush() ;
+    std::fflush(stdout) ;
+    CLOptionsHelper::write_all(STDOUT_FILENO, help_cache_.data(), help_cache_.size()) ;
+}
+
+//__________________________________________________________
+void CLOptions::PrintDescription(const std::string& param_description, int left_padding)
+{
+    std::string text ;
+    AppendDescription(text, param_description, left_padding, CLOptionsHelper::terminal_width()) ;
+    if (CLOptionsHelper::message_capture() != 0) {
+        CLOptionsHelper::message_capture()->write(text.data(), text.size()) ;
+        return ;
+    }
+    std::cout.flush() ;
+    std::fflush(stdout) ;
+    CLOptionsHelper::write_all(STDOUT_FILENO, text.data(), text.size()) ;
+}
+
+//__________________________________________________________
+void CLOptions::RenderHelp(const std::string& executable_name, size_t width,
+                           std::string& out) const
+{
+    // Size the buffer for the whole text up front
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    size_t size_estimate = 256 + executable_name.size() + 2*program_desc_.size() ;
+    for (size_t i=0; i<entries.size(); i++) {
+        size_estimate += 64 + 2*entries[i].name.size() +
+                         entries[i].param->getDescription().size() * 11 / 10 ;
+    }
+    out.clear() ;
+    out.reserve(size_estimate) ;
+    
     // Print version if available
     if (!version_opt.getParamName().empty()) {
-        std::cout << version_opt.getValue() << std::endl;
+        out += version_opt.getValue() ;
+        out += '\n' ;
     }
-
+    
     // Print usage information
-    std::cout << "\nUSAGE: " << executable_name << " [options]" << std::endl;
+    out += "\nUSAGE: " ;
+    out += executable_name ;
+    if (subcommands_.empty()) {
+        out += " [options]\n" ;
+    } else if (subcommand_.empty()) {
+        out += " [options] <command> [command options]\n" ;
+    } else {
+        out += " [options] " + subcommand_ + " [command options]\n" ;
+    }
+    
+    // Print the descripton of the program (or of the subcommand)
+    if (!subcommand_.empty()) {
+        out += "\nDESCRIPTION:\n" ;
+        AppendDescription(out, subcommands_.find(subcommand_)->second.description, 2, width) ;
+    } else if (!program_desc_.empty()) {
+        out += "\nDESCRIPTION:\n" ;
+        AppendDescription(out, program_desc_, 2, width) ;
+    }
     
-    // Print the descripton of the program
-    if (!program_desc_.empty()) {
-        std::cout << "\nDESCRIPTION:\n" ;
-        PrintDescription(program_desc_, 2) ;
+    // List the subcommands until one has been selected
+    if (!subcommands_.empty() && subcommand_.empty()) {
+        out += "\nCOMMANDS:\n" ;
+        std::map<std::string, Subcommand>::const_iterator subcommand ;
+        for (subcommand=subcommands_.begin(); subcommand!=subcommands_.end(); ++subcommand) {
+            out += "  " + subcommand->first + "\n" ;
+            AppendDescription(out, subcommand->second.description, CLOPT_PAD_DESCRIPTION_WIDTH, width) ;
+        }
     }
     
-    std::cout << "\nAVAILABLE OPTIONS:" << std::endl;
+    out += "\nAVAILABLE OPTIONS:\n" ;
     
     // Specify the help information
-    std::printf("  -h, --help [no argument]\n") ;
-    PrintDescription("Prints out this help information.") ;
+    out += "  -h, --help [no argument]\n" ;
+    AppendDescription(out, "Prints out this help information.", CLOPT_PAD_DESCRIPTION_WIDTH, width) ;
     
     // Specify the version information
     if (!version_opt.getParamName().empty()) {
-        std::printf("  -v, --%s [no argument]\n", version_opt.getParamName().c_str()) ;
-        PrintDescription(version_opt.getDescription()) ;
-    }
-    
-    // Loop through the parameters and print their current values
-    
-    // BOOLEANS
-    std::map<std::string, CLBool*>::iterator bool_itr ;
-    for (bool_itr=params_bools.begin(); bool_itr!=params_bools.end(); ++bool_itr) {
-        std::printf("  -%s [bool, default=%d]\n",
-                    bool_itr->second->getFullParamName().c_str(),
-                    bool_itr->second->getDefault()) ;
-        PrintDescription(bool_itr->second->getDescription()) ;
-    }
-    // DOUBLES
-    std::map<std::string, CLDouble*>::iterator dbl_itr ;
-    for (dbl_itr=params_doubles.begin(); dbl_itr!=params_doubles.end(); ++dbl_itr) {
-        std::printf("  -%s [double, default=%f]\n",
-                    dbl_itr->second->getFullParamName().c_str(),
-                    dbl_itr->second->getDefault()) ;
-        PrintDescription(dbl_itr->second->getDescription()) ;
-    }
-    // INTEGERS
-    std::map<std::string, CLInt*>::iterator int_itr ;
-    for (int_itr=params_ints.begin(); int_itr!=params_ints.end(); ++int_itr) {
-        std::printf("  -%s [int, default=%d]\n",
-                    int_itr->second->getFullParamName().c_str(),
-                    int_itr->second->getDefault()) ;
-        PrintDescription(int_itr->second->getDescription()) ;
-    }
-    // STRINGS
-    std::map<std::string, CLString*>::iterator str_itr ;
-    for (str_itr=params_strings.begin(); str_itr!=params_strings.end(); ++str_itr) {
-        std::printf("  -%s [string, default=%s]\n",
-                    str_itr->second->getFullParamName().c_str(),
-                    str_itr->second->getDefault().c_str()) ;
-        PrintDescription(str_itr->second->getDescription()) ;
-    }
-    std::cout << std::endl;
+        out += "  -v, --" ;
+        out += version_opt.getParamName() ;
+        out += " [no argument]\n" ;
+        AppendDescription(out, version_opt.getDescription(), CLOPT_PAD_DESCRIPTION_WIDTH, width) ;
+    }
+    
+    // Loop through the parameters (grouped by type) and print their defaults
+    CLParamType types[] = {CL_BOOL, CL_DOUBLE, CL_INT, CL_STRING,
+                           CL_INT_LIST, CL_DOUBLE_LIST, CL_STRING_LIST} ;
+    std::string default_str ;
+    for (int t=0; t<7; t++) {
+        std::vector<const CLParamRegistry::Entry*> sorted = params_.Sorted(types[t]) ;
+        for (size_t i=0; i<sorted.size(); i++) {
+            const CLParamBase* param = sorted[i]->param ;
+            switch (types[t]) {
+                case CL_BOOL:
+                    default_str = static_cast<const CLBool*>(param)->getDefault() ? "1" : "0" ;
+                    break ;
+                case CL_DOUBLE: {
+                    char buffer[512] ;
+                    std::snprintf(buffer, sizeof(buffer), "%f", static_cast<const CLDouble*>(param)->getDefault()) ;
+                    default_str = buffer ;
+                    break ;
+                }
+                case CL_INT:
+                    CLOptionsHelper::to_string(static_cast<const CLInt*>(param)->getDefault(), default_str) ;
+                    break ;
+                case CL_STRING:
+                    default_str = static_cast<const CLString*>(param)->getDefault() ;
+                    break ;
+                case CL_INT_LIST:
+                    CLOptionsHelper::to_string(static_cast<const CLList<int>*>(param)->getDefault(), default_str) ;
+                    break ;
+                case CL_DOUBLE_LIST:
+                    CLOptionsHelper::to_string(static_cast<const CLList<double>*>(param)->getDefault(), default_str) ;
+                    break ;
+                case CL_STRING_LIST:
+                    CLOptionsHelper::to_string(static_cast<const CLList<std::string>*>(param)->getDefault(), default_str) ;
+                    break ;
+            }
+            out += "  -" ;
+            out += param->getFullParamName() ;
+            out += " [" ;
+            out += CLTypeName(types[t]) ;
+            out += ", default=" ;
+            out += default_str ;
+            out += "]\n" ;
+            AppendDescription(out, param->getDescription(), CLOPT_PAD_DESCRIPTION_WIDTH, width) ;
+        }
+    }
+    out += '\n' ;
 }
 
 //__________________________________________________________
-void CLOptions::PrintDescription(const std::string& param_description, int left_padding)
+// Appends the description to 'out', wrapping the words so that the lines
+// are at most 'width' characters long (unless a single word is longer)
+void CLOptions::AppendDescription(std::string& out,
+                                  const std::string& param_description,
+                                  int left_padding, size_t width)
 {
-    // Split the description into individual words
-    std::vector<std::string> desc_words = CLOptionsHelper::split(param_description, ' ') ;
-    std::vector<std::string>::iterator word ;
-    
     size_t current_length(0) ;
-    
-    for (word=desc_words.begin(); word!=desc_words.end(); ++word) {
-        // If there are no words on this line, print the next word
-        if (current_length == 0) {
-            for (int s=0; s<left_padding; s++) std::cout << " " ;
-            std::cout << (*word) << " " ;
-            current_length = left_padding + word->length() + 1 ;
-        }
-        // Else, if the next word would send us over the limit of the
-        // line, print a new line and then print the word
-        else if (current_length+word->length() > CLOPT_MAX_WIDTH) {
-            std::cout << std::endl ;
-            for (int s=0; s<left_padding; s++) std::cout << " " ;
-            std::cout << (*word) << " " ;
-            current_length = left_padding + word->length() + 1 ;
+    size_t pos(0) ;
+    while (pos < param_description.size()) {
+        // Find the next word (note that repeated spaces give empty words)
+        size_t word_end = param_description.find(' ', pos) ;
+        if (word_end == std::string::npos) word_end = param_description.size() ;
+        size_t word_length = word_end - pos ;
+        
+        // Start a new line if this word would go over the limit of the line
+        if ((current_length != 0) && (current_length + word_length > width)) {
+            out += '\n' ;
+            current_length = 0 ;
         }
-        // Else, just print the word
-        else {
-            std::cout << (*word) << " " ;
-            current_length += word->length() + 1 ;
+        if (current_length == 0) {
+            out.append(left_padding, ' ') ;
+            current_length = left_padding ;
         }
+        out.append(param_description, pos, word_length) ;
+        out += ' ' ;
+        current_length += word_length + 1 ;
+        
+        pos = word_end + 1 ;
     }
-    std::cout << std::endl;
+    out += '\n' ;
 }
 
 //__________________________________________________________
@@ -936,10 +3298,7 @@ void CLOptions::DefineParams()
     longopts.clear() ;
     
     // Resize it to hold exactly the number of variables we need
-    int options_count = params_bools.size() +
-                        params_doubles.size() +
-                        params_ints.size() +
-                        params_strings.size() + 2 ;
+    int options_count = params_.size() + 2 ;
     if (!version_opt.getParamName().empty()) options_count++ ;
     
     longopts = std::vector<struct option>(options_count) ;
@@ -953,32 +3312,11 @@ void CLOptions::DefineParams()
         longopts[opt_num++] = DefineOptSingle(version_str, no_argument, 0, 'v') ;
     }
     
-    // Add the bool options
-    std::map<std::string, CLBool*>::iterator biter ;
-    for (biter=params_bools.begin(); biter!=params_bools.end(); ++biter) {
-        longopts[opt_num++] = DefineOptSingle(biter->first, required_argument, 0,
-                                              biter->second->getShortParamName()) ;
-    }
-    
-    // Add the double options
-    std::map<std::string, CLDouble*>::iterator diter ;
-    for (diter=params_doubles.begin(); diter!=params_doubles.end(); ++diter) {
-        longopts[opt_num++] = DefineOptSingle(diter->first, required_argument, 0, 
-                                              diter->second->getShortParamName()) ;
-    }
-    
-    // Add the int options
-    std::map<std::string, CLInt*>::iterator iiter ;
-    for (iiter=params_ints.begin(); iiter!=params_ints.end(); ++iiter) {
-        longopts[opt_num++] = DefineOptSingle(iiter->first, required_argument, 0, 
-                                              iiter->second->getShortParamName()) ;
-    }
-    
-    // Add the string options
-    std::map<std::string, CLString*>::iterator siter ;
-    for (siter=params_strings.begin(); siter!=params_strings.end(); ++siter) {
-        longopts[opt_num++] = DefineOptSingle(siter->first, required_argument, 0, 
-                                              siter->second->getShortParamName()) ;
+    // Add all of the parameters
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    for (size_t i=0; i<entries.size(); i++) {
+        longopts[opt_num++] = DefineOptSingle(entries[i].name, required_argument, 0,
+                                              entries[i].param->getShortParamName()) ;
     }
     
     // Add the terminating options
@@ -1002,30 +3340,243 @@ struct option CLOptions::DefineOptSingle(const std::string& name, int has_arg, i
 // from the file
 bool CLOptions::FillFromFile(const std::string& filename)
 {
-    // First make sure that the file can actually be opened for reading
-    if (!CLOptionsHelper::file_exists(filename)) {
+    CLOPT_STATS_SCOPE(config_file_ns) ;
+    
+    // Map the file into memory so that it's only opened once and the lines
+    // can be processed in place
+    CLOptionsHelper::MappedFile configFile ;
+    if (!configFile.Open(filename, map_config_files_)) {
+        // note that the name is put in quotes to show when
+        // extra white space has been added
+        CLOptionsHelper::errors(std::cout) << "[ERROR] File does not exist:\n   \"" << filename << "\"" << std::endl;
         return true ;
     }
+    CLOPT_STATS_ADD(bytes_read, configFile.size()) ;
     
-    // Open the supplied file
-    std::ifstream configFile(filename.c_str()) ;
-    std::string line ;
-    while (std::getline(configFile, line)) {
+    const char* file_end = configFile.data() + configFile.size() ;
+    const char* line_end = 0 ;
+    for (const char* line = configFile.data(); line < file_end; line = line_end + 1) {
+        line_end = static_cast<const char*>(std::memchr(line, '\n', file_end - line)) ;
+        if (line_end == 0) line_end = file_end ;
+        CLOPT_STATS_ADD(lines_read, 1) ;
+        
+        // Ignore any carriage return from files with windows line endings
+        const char* text_end = line_end ;
+        if ((text_end > line) && (*(text_end-1) == '\r')) text_end-- ;
+        
         // Skip if the line is empty
-        if (line.empty()) continue ;
+        if (text_end == line) continue ;
         // Skip if the line is a comment
-        if (line.find(configfile_comment) == 0) continue ;
+        if (!configfile_comment.empty() &&
+            (size_t(text_end - line) >= configfile_comment.size()) &&
+            (std::memcmp(line, configfile_comment.data(), configfile_comment.size()) == 0)) continue ;
+        
+        // The parameter name is everything up to the first space, and the
+        // value is what follows it (up to the next space)
+        const char* name_end = static_cast<const char*>(std::memchr(line, ' ', text_end - line)) ;
+        if ((name_end == 0) || (name_end+1 == text_end)) continue ;
+        const char* value = name_end + 1 ;
+        
+        // Now actually set the parameter, noting that an invalid value
+        // is treated as an error (but an unknown name isnt). Lists take
+        // the rest of the line.
+        const CLParamRegistry::Entry* entry = params_.Find(line, name_end - line) ;
+        if (entry == 0) {
+            std::string suggestion = SuggestName(line, name_end - line, false) ;
+            CLOptionsHelper::errors() << "[WARNING] CLOptions::FillFromFile() :: unknown parameter '"
+                      << std::string(line, name_end) << "' in \"" << filename << "\"" ;
+            if (!suggestion.empty()) CLOptionsHelper::errors() << "; did you mean '" << suggestion << "'?" ;
+            CLOptionsHelper::errors() << std::endl;
+            continue ;
+        }
+        const char* value_end = text_end ;
+        if (!CLIsListType(entry->type)) {
+            value_end = static_cast<const char*>(std::memchr(value, ' ', text_end - value)) ;
+            if (value_end == 0) value_end = text_end ;
+        }
+        if (SetParamValue(*entry, value, value_end - value, CL_SOURCE_CONFIGFILE) != CL_CONVERT_OK) {
+            return true ;
+        }
+    }
+    
+    return false ;
+}
+
+//__________________________________________________________
+// Note this method returns true when one of the values is invalid
+bool CLOptions::FillFromEnvironment(const std::string& prefix)
+{
+    CLOPT_STATS_SCOPE(environment_ns) ;
+    
+    // The parameters are indexed by their names in the environment along
+    // with the other lookup tables, so each variable is matched with a
+    // binary search
+    BuildTables() ;
+    typedef std::pair<std::string, int> IndexEntry ;
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    
+    // Now walk through the environment once, setting every match
+    for (char** env = environ; (env != 0) && (*env != 0); env++) {
+        const char* var = *env ;
+        if (std::strncmp(var, prefix.c_str(), prefix.size()) != 0) continue ;
+        const char* name = var + prefix.size() ;
+        const char* value = std::strchr(name, '=') ;
+        if (value == 0) continue ;
+        
+        IndexEntry key(std::string(name, value), 0) ;
+        std::vector<IndexEntry>::const_iterator match = std::lower_bound(env_names_.begin(), env_names_.end(), key) ;
+        if ((match == env_names_.end()) || (match->first != key.first)) continue ;
+        
+        // Dont guess which parameter is meant if several have this name
+        std::vector<IndexEntry>::const_iterator next = match + 1 ;
+        if ((next != env_names_.end()) && (next->first == key.first)) {
+            CLOptionsHelper::errors() << "[ERROR] CLOptions::FillFromEnvironment() :: environment variable '"
+                                      << prefix << key.first << "' matches several parameters:" ;
+            for (; (match != env_names_.end()) && (match->first == key.first); ++match) {
+                CLOptionsHelper::errors() << " '" << entries[match->second].name << "'" ;
+            }
+            CLOptionsHelper::errors() << std::endl;
+            return true ;
+        }
         
-        // Split the line on spaces
-        std::vector<std::string> param = CLOptionsHelper::split(line, ' ') ;
+        value++ ;
+        if (SetParamValue(entries[match->second], value, std::strlen(value), CL_SOURCE_ENVIRONMENT) != CL_CONVERT_OK) return true ;
+    }
+    
+    return false ;
+}
+
+//__________________________________________________________
+// Snapshot layout (all values in native byte order):
+//    header : "CLOPTSNP", uint32 version, uint32 byte order mark,
+//             uint32 number of entries, uint32 unused, uint64 file size
+//    entries: uint8 type, uint8 source, uint16 name length, uint32 value
+//             length, name, value, padded to a multiple of 8 bytes
+#define CLOPT_SNAPSHOT_MAGIC   "CLOPTSNP"
+#define CLOPT_SNAPSHOT_VERSION 2
+#define CLOPT_SNAPSHOT_BOM     0x01020304u
+
+bool CLOptions::SaveSnapshot(const std::string& filename) const
+{
+    const std::vector<CLParamRegistry::Entry>& entries = params_.Entries() ;
+    
+    // Build the whole snapshot in memory so that it's written in one go
+    std::string snapshot(CLOPT_SNAPSHOT_MAGIC) ;
+    CLOptionsHelper::to_binary(uint32_t(CLOPT_SNAPSHOT_VERSION), snapshot) ;
+    CLOptionsHelper::to_binary(uint32_t(CLOPT_SNAPSHOT_BOM), snapshot) ;
+    CLOptionsHelper::to_binary(uint32_t(entries.size()), snapshot) ;
+    CLOptionsHelper::to_binary(uint32_t(0), snapshot) ;
+    size_t size_pos = snapshot.size() ;
+    CLOptionsHelper::to_binary(uint64_t(0), snapshot) ;
+    
+    std::string value ;
+    for (size_t i=0; i<entries.size(); i++) {
+        value.clear() ;
+        entries[i].param->appendBinary(value) ;
+        snapshot += char(entries[i].type) ;
+        snapshot += char(entries[i].param->getSource()) ;
+        CLOptionsHelper::to_binary(uint16_t(entries[i].name.size()), snapshot) ;
+        CLOptionsHelper::to_binary(uint32_t(value.size()), snapshot) ;
+        snapshot += entries[i].name ;
+        snapshot += value ;
+        snapshot.resize((snapshot.size() + 7) & ~size_t(7), '\0') ;
+    }
+    uint64_t total_size = snapshot.size() ;
+    std::memcpy(&snapshot[size_pos], &total_size, sizeof(total_size)) ;
+    
+    std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc) ;
+    file.write(snapshot.data(), snapshot.size()) ;
+    if (!file.good()) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::SaveSnapshot() :: Unable to write snapshot \"" << filename << "\"" << std::endl;
+        return true ;
+    }
+    return false ;
+}
+
+//__________________________________________________________
+bool CLOptions::LoadSnapshot(const std::string& filename)
+{
+    CLOptionsHelper::MappedFile file ;
+    if (!file.Open(filename)) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::LoadSnapshot() :: Unable to open snapshot \"" << filename << "\"" << std::endl;
+        return true ;
+    }
+    
+    // Validate the header
+    const size_t header_size = 32 ;
+    const char* data = file.data() ;
+    uint32_t version(0), bom(0), n_entries(0) ;
+    uint64_t total_size(0) ;
+    if ((file.size() < header_size) ||
+        (std::memcmp(data, CLOPT_SNAPSHOT_MAGIC, 8) != 0) ||
+        !CLOptionsHelper::from_binary(data+8,  4, version) || (version != CLOPT_SNAPSHOT_VERSION) ||
+        !CLOptionsHelper::from_binary(data+12, 4, bom)     || (bom != CLOPT_SNAPSHOT_BOM) ||
+        !CLOptionsHelper::from_binary(data+16, 4, n_entries) ||
+        !CLOptionsHelper::from_binary(data+24, 8, total_size) || (total_size != file.size())) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::LoadSnapshot() :: \"" << filename << "\" is not a valid snapshot" << std::endl;
+        return true ;
+    }
+    // Every entry takes at least 8 bytes, so dont trust a larger count
+    if (n_entries > (file.size() - header_size) / 8) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::LoadSnapshot() :: \"" << filename << "\" is truncated" << std::endl;
+        return true ;
+    }
+    
+    // Check that every entry matches a parameter before setting any of them
+    struct SnapshotValue {
+        const CLParamRegistry::Entry* entry ;
+        const char* value ;
+        uint32_t    value_len ;
+        CLSource    source ;
+    } ;
+    std::vector<SnapshotValue> values(n_entries) ;
+    const char* pos = data + header_size ;
+    const char* end = data + file.size() ;
+    for (uint32_t i=0; i<n_entries; i++) {
+        uint16_t name_len(0) ;
+        uint32_t value_len(0) ;
+        if ((end - pos < 8) ||
+            !CLOptionsHelper::from_binary(pos+2, 2, name_len) ||
+            !CLOptionsHelper::from_binary(pos+4, 4, value_len) ||
+            (size_t(end - pos) < ((8 + size_t(name_len) + value_len + 7) & ~size_t(7)))) {
+            CLOptionsHelper::errors() << "[ERROR] CLOptions::LoadSnapshot() :: \"" << filename << "\" is truncated" << std::endl;
+            return true ;
+        }
         
-        // Create a separate string vector that represents the user
-        // defined values for this parameter
-        std::vector<std::string> values(param.begin()+1, param.end()) ;
-        if (values.size() == 0) continue ;
+        // Note that the type and source are read as unsigned bytes
+        unsigned char type   = (unsigned char)pos[0] ;
+        unsigned char source = (unsigned char)pos[1] ;
+        const CLParamRegistry::Entry* entry = params_.Find(pos + 8, name_len) ;
+        if ((entry == 0) || (entry->type != type) || (source > CL_SOURCE_OVERRIDE)) {
+            CLOptionsHelper::errors() << "[ERROR] CLOptions::LoadSnapshot() :: Parameter \"" << std::string(pos + 8, name_len)
+                      << "\" in the snapshot does not match the defined parameters" << std::endl;
+            return true ;
+        }
+        if (!entry->param->checkBinary(pos + 8 + name_len, value_len)) {
+            CLOptionsHelper::errors() << "[ERROR] CLOptions::LoadSnapshot() :: Invalid value for parameter \""
+                      << entry->name << "\" in the snapshot" << std::endl;
+            return true ;
+        }
+        values[i].entry     = entry ;
+        values[i].value     = pos + 8 + name_len ;
+        values[i].value_len = value_len ;
+        values[i].source    = CLSource(source) ;
         
-        // Now actually set the parameter
-        if (!SetParam(param.front(), values)) return false ;
+        pos += (8 + size_t(name_len) + value_len + 7) & ~size_t(7) ;
+    }
+    if (pos != end) {
+        CLOptionsHelper::errors() << "[ERROR] CLOptions::LoadSnapshot() :: \"" << filename << "\" is not a valid snapshot" << std::endl;
+        return true ;
+    }
+    
+    // Now copy the values into the parameters
+    for (uint32_t i=0; i<n_entries; i++) {
+        if (!values[i].entry->param->setFromBinary(values[i].value, values[i].value_len, values[i].source)) {
+            CLOptionsHelper::errors() << "[ERROR] CLOptions::LoadSnapshot() :: Invalid value for parameter \""
+                      << values[i].entry->name << "\" in the snapshot" << std::endl;
+            return true ;
+        }
+        values[i].entry->param->updateValueStr() ;
     }
     
     return false ;
@@ -0,0 +1,135 @@
+//
+//  CLOptionsBatch.h
+//  CLOptions
+//
+//--------------------------------------------------------
+// This header provides 'CLBatchParser', which parses many
+// command lines against the same set of options, e.g. to
+// validate a queue of jobs before submitting them. The
+// options are cloned once for each worker thread and then
+// reused for every command line that thread parses, so the
+// parameters are never defined again for each job. For
+// example:
+//
+//    CLBatchParser parser(DefineOptions()) ;
+//    std::vector<CLBatchResult> results = parser.Parse(jobs) ;
+//    for (size_t i=0; i<results.size(); i++) {
+//        if (results[i].error) std::cout << results[i].messages ;
+//    }
+//
+// Each job is a full command line (including the program
+// name as its first element). The messages printed while
+// parsing a job (including any help text requested with
+// '-h') are collected in its result rather than printed.
+//--------------------------------------------------------
+
+#ifndef CLOptionsBatch_h
+#define CLOptionsBatch_h
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include "CLOptions.h"
+
+/***************************************
+ * CLBatchResult
+ * Outcome of parsing one command line
+ ***************************************/
+struct CLBatchResult {
+    bool            error = false ;   // Whether 'ParseCommandLine' returned true
+    std::string     messages ;        // Everything printed while parsing
+    CLFrozenOptions values ;          // Parsed values (empty if there was an error
+                                      // or the values werent requested)
+};
+
+/***************************************
+ * CLBatchParser
+ * Parses many command lines in parallel against one set of options
+ ***************************************/
+class CLBatchParser {
+public:
+    // Note that 'options' should only define the parameters (i.e. it
+    // shouldnt have been parsed). Uses one thread per core by default.
+    explicit CLBatchParser(const CLOptions& options, unsigned n_threads = 0) :
+        schema_(options.Clone()), n_threads_(n_threads)
+    {
+        if (n_threads_ == 0) n_threads_ = std::thread::hardware_concurrency() ;
+        if (n_threads_ == 0) n_threads_ = 1 ;
+    }
+    CLBatchParser(const CLBatchParser& other) = delete ;
+    CLBatchParser& operator=(const CLBatchParser& other) = delete ;
+    virtual ~CLBatchParser() {}
+
+    // Parse every job, returning one result per job (in the same order).
+    // If 'keep_values' is false only the errors are reported, which is
+    // enough to validate the jobs and avoids copying the values.
+    std::vector<CLBatchResult> Parse(const std::vector<std::vector<std::string> >& jobs,
+                                     bool keep_values = true) ;
+
+    unsigned GetThreadCount() const {return n_threads_ ;}
+
+protected:
+    // Parse the jobs handed out through 'next_job' with one copy of the options
+    void Work(CLOptions& options, const std::vector<std::vector<std::string> >& jobs,
+              bool keep_values, std::atomic<size_t>& next_job,
+              std::vector<CLBatchResult>& results) const ;
+
+    CLOptions              schema_ ;    // Parameter definitions
+    std::vector<CLOptions> workers_ ;   // Copy of the options for each thread
+    unsigned               n_threads_ ;
+private:
+};
+
+//__________________________________________________________
+std::vector<CLBatchResult> CLBatchParser::Parse(const std::vector<std::vector<std::string> >& jobs,
+                                                bool keep_values)
+{
+    std::vector<CLBatchResult> results(jobs.size()) ;
+    if (jobs.empty()) return results ;
+
+    // The copies of the options are kept for the next batch
+    size_t n_threads = std::min<size_t>(n_threads_, jobs.size()) ;
+    while (workers_.size() < n_threads) workers_.push_back(schema_.Clone()) ;
+
+    // Small batches arent worth starting threads for
+    std::atomic<size_t> next_job(0) ;
+    if (n_threads == 1) {
+        Work(workers_[0], jobs, keep_values, next_job, results) ;
+        return results ;
+    }
+    std::vector<std::thread> threads ;
+    for (size_t i=0; i<n_threads; i++) {
+        threads.push_back(std::thread(&CLBatchParser::Work, this, std::ref(workers_[i]),
+                                      std::cref(jobs), keep_values, std::ref(next_job),
+                                      std::ref(results))) ;
+    }
+    for (size_t i=0; i<threads.size(); i++) threads[i].join() ;
+    return results ;
+}
+
+//__________________________________________________________
+void CLBatchParser::Work(CLOptions& options, const std::vector<std::vector<std::string> >& jobs,
+                         bool keep_values, std::atomic<size_t>& next_job,
+                         std::vector<CLBatchResult>& results) const
+{
+    std::ostringstream messages ;
+    CLOptionsHelper::MessageCapture capture(messages) ;
+    std::vector<char*> argv ;
+
+    for (size_t job = next_job.fetch_add(1); job < jobs.size(); job = next_job.fetch_add(1)) {
+        // Note that the arguments are only read, never modified
+        const std::vector<std::string>& args = jobs[job] ;
+        argv.assign(args.size() + 1, static_cast<char*>(0)) ;
+        for (size_t i=0; i<args.size(); i++) argv[i] = const_cast<char*>(args[i].c_str()) ;
+
+        CLBatchResult& result = results[job] ;
+        result.error = options.ParseCommandLine(int(args.size()), &argv[0]) ;
+        if (options.ConvertPending()) result.error = true ;
+        if (keep_values && !result.error) result.values = options.Freeze() ;
+        result.messages = messages.str() ;
+        messages.str(std::string()) ;
+        options.Reset() ;
+    }
+}
+
+#endif /* CLOptionsBatch_h */
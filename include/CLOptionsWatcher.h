@@ -0,0 +1,290 @@
+//
+//  CLOptionsWatcher.h
+//  CLOptions
+//
+//--------------------------------------------------------
+// This header provides 'CLConfigWatcher', which keeps the
+// options of a long running program up to date with its
+// configuration file. Whenever the file changes, the
+// options are parsed again into a new, immutable CLOptions
+// object which is then published to the reading threads.
+// Reading threads never take a lock and always see one
+// complete set of options. For example:
+//
+//    CLConfigWatcher watcher(DefineOptions(), argc, argv) ;
+//    if (watcher.Start()) return 1 ;
+//    ...
+//    // In any thread
+//    CLConfigWatcher::Reader options = watcher.Read() ;
+//    double tol = options->AsDouble("Tolerance") ;
+//
+// Note that the CLOptions object passed to the watcher
+// should only define the parameters (i.e. it shouldnt have
+// been parsed), since each reload reads the configuration
+// file and then applies the command line on top of it.
+//
+// The file is watched with inotify on Linux. On other
+// systems its modification time is checked periodically.
+//--------------------------------------------------------
+
+#ifndef CLOptionsWatcher_h
+#define CLOptionsWatcher_h
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "CLOptions.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+// How often (in milliseconds) the file is checked when inotify isnt available
+#ifndef CLOPT_WATCH_POLL_INTERVAL
+#define CLOPT_WATCH_POLL_INTERVAL 500
+#endif
+
+/***************************************
+ * CLConfigWatcher
+ * Reloads a set of options when their configuration file changes
+ ***************************************/
+class CLConfigWatcher {
+public:
+    /***************************************
+     * Reader
+     * Gives a thread access to the current options. The options seen
+     * through a Reader dont change (and arent deleted) for as long as
+     * the Reader exists, so Readers should be short lived.
+     ***************************************/
+    class Reader {
+    public:
+        Reader(Reader&& other) : counter_(other.counter_), options_(other.options_)
+        {other.counter_ = 0 ;}
+        Reader(const Reader& other) = delete ;
+        Reader& operator=(const Reader& other) = delete ;
+        virtual ~Reader() {if (counter_ != 0) counter_->fetch_sub(1) ;}
+
+        const CLOptions& operator*() const {return *options_ ;}
+        const CLOptions* operator->() const {return options_ ;}
+    protected:
+        friend class CLConfigWatcher ;
+        explicit Reader(const CLConfigWatcher& watcher) :
+            counter_(&watcher.readers_[watcher.epoch_.load() & 1])
+        {
+            // Announce the reader before loading the options, so that the
+            // options cant be deleted after they've been loaded
+            counter_->fetch_add(1) ;
+            options_ = watcher.current_.load() ;
+        }
+
+        std::atomic<long>* counter_ ;
+        const CLOptions*   options_ ;
+    private:
+    };
+
+    CLConfigWatcher(const CLOptions& options, int argc, char** argv) :
+        schema_(options.Clone()), args_(argv, argv + argc),
+        current_(0), epoch_(0), generation_(0), running_(false)
+    {
+        readers_[0] = 0 ;
+        readers_[1] = 0 ;
+        stop_pipe_[0] = stop_pipe_[1] = -1 ;
+        // The file may be rewritten while it's being reloaded
+        schema_.SetMapConfigFiles(false) ;
+    }
+    CLConfigWatcher(const CLConfigWatcher& other) = delete ;
+    CLConfigWatcher& operator=(const CLConfigWatcher& other) = delete ;
+    virtual ~CLConfigWatcher()
+    {
+        // Note that there shouldnt be any readers left at this point
+        Stop() ;
+        delete current_.load() ;
+    }
+
+    // Parse the options for the first time and start watching the
+    // configuration file. Returns true if there has been an error.
+    bool Start() ;
+    // Stop watching the configuration file
+    void Stop() ;
+    // Parse the options again and publish them to the readers. This is
+    // called automatically when the file changes, but can also be called
+    // directly. Returns true (and keeps the current options) if there
+    // has been an error.
+    bool Reload() ;
+
+    // Get access to the current options
+    Reader Read() const {return Reader(*this) ;}
+    // Number of times the options have been (re)loaded
+    unsigned long Generation() const {return generation_.load() ;}
+    // Name of the file being watched
+    const std::string& GetFileName() const {return filename_ ;}
+
+protected:
+    // Wait until no reader can still be using options that have been
+    // replaced. Each reader registers with the counter for the epoch it
+    // started in, so flipping the epoch twice and waiting for each
+    // counter to drain guarantees that all earlier readers are done.
+    void WaitForReaders()
+    {
+        for (int flip=0; flip<2; flip++) {
+            unsigned old_epoch = epoch_.fetch_add(1) ;
+            while (readers_[old_epoch & 1].load() != 0) std::this_thread::yield() ;
+        }
+    }
+
+    void WatchLoop() ;
+    
+    // Modification time of a file (the name of the field varies)
+    static struct timespec ModificationTime(const struct stat& info)
+    {
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+        return info.st_mtimespec ;
+#else
+        return info.st_mtim ;
+#endif
+    }
+
+    CLOptions                 schema_ ;    // Parameter definitions
+    std::vector<std::string>  args_ ;      // Copy of the command line
+    std::string               filename_ ;
+
+    std::atomic<const CLOptions*> current_ ;
+    mutable std::atomic<unsigned> epoch_ ;
+    mutable std::atomic<long>     readers_[2] ;
+    std::atomic<unsigned long>    generation_ ;
+    std::mutex                    reload_mutex_ ;   // Only taken by writers
+
+    std::thread       watch_thread_ ;
+    std::atomic<bool> running_ ;
+    int               stop_pipe_[2] ;
+private:
+};
+
+//__________________________________________________________
+bool CLConfigWatcher::Start()
+{
+    if (running_.load()) return false ;
+    if (Reload()) return true ;
+
+    // Figure out which file to watch
+    const CLOptions& options = *current_.load() ;
+    if (options.GetConfigFileOption().empty() ||
+        options[options.GetConfigFileOption()].empty()) {
+        CLOptionsHelper::errors() << "[ERROR] CLConfigWatcher::Start() :: No configuration file to watch" << std::endl;
+        return true ;
+    }
+    filename_ = options[options.GetConfigFileOption()] ;
+
+    if (::pipe(stop_pipe_) != 0) {
+        CLOptionsHelper::errors() << "[ERROR] CLConfigWatcher::Start() :: Unable to create pipe" << std::endl;
+        return true ;
+    }
+    running_ = true ;
+    watch_thread_ = std::thread(&CLConfigWatcher::WatchLoop, this) ;
+    return false ;
+}
+
+//__________________________________________________________
+void CLConfigWatcher::Stop()
+{
+    if (!running_.load()) return ;
+    running_ = false ;
+
+    // Wake up the watching thread
+    char wake = 0 ;
+    if (::write(stop_pipe_[1], &wake, 1) < 0) {}
+    watch_thread_.join() ;
+    ::close(stop_pipe_[0]) ;
+    ::close(stop_pipe_[1]) ;
+    stop_pipe_[0] = stop_pipe_[1] = -1 ;
+}
+
+//__________________________________________________________
+bool CLConfigWatcher::Reload()
+{
+    std::lock_guard<std::mutex> lock(reload_mutex_) ;
+
+    // Build the new options from scratch, applying the configuration file
+    // and then the command line (exactly as on startup)
+    CLOptions* new_options = new CLOptions(schema_.Clone()) ;
+    std::vector<char*> argv(args_.size() + 1, static_cast<char*>(0)) ;
+    for (size_t i=0; i<args_.size(); i++) argv[i] = &args_[i][0] ;
+    // Values left as text by lazy conversion are converted now, since the
+    // published options are read from several threads without locks
+    if (new_options->ParseCommandLine(int(args_.size()), &argv[0]) ||
+        new_options->ConvertPending()) {
+        CLOptionsHelper::errors() << "[ERROR] CLConfigWatcher::Reload() :: Unable to reload options, keeping the current ones" << std::endl;
+        delete new_options ;
+        return true ;
+    }
+
+    // Publish the new options and delete the old ones once they're unused
+    const CLOptions* old_options = current_.exchange(new_options) ;
+    generation_++ ;
+    if (old_options != 0) {
+        WaitForReaders() ;
+        delete old_options ;
+    }
+    return false ;
+}
+
+//__________________________________________________________
+void CLConfigWatcher::WatchLoop()
+{
+    // Editors often replace the file rather than writing to it, so watch
+    // the directory containing the file. Note that creating the file isnt
+    // a change by itself, since it's still empty at that point.
+    size_t slash = filename_.rfind('/') ;
+    std::string dir  = (slash == std::string::npos) ? "." : filename_.substr(0, slash+1) ;
+    std::string base = (slash == std::string::npos) ? filename_ : filename_.substr(slash+1) ;
+
+#ifdef __linux__
+    int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC) ;
+    if ((fd >= 0) && (::inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0)) {
+        struct pollfd fds[2] ;
+        fds[0].fd = fd ;
+        fds[0].events = POLLIN ;
+        fds[1].fd = stop_pipe_[0] ;
+        fds[1].events = POLLIN ;
+
+        char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event)))) ;
+        while (running_.load()) {
+            if (::poll(fds, 2, -1) <= 0) continue ;
+            if (fds[1].revents != 0) break ;
+
+            // Check whether any of the events refer to our file
+            bool changed = false ;
+            ssize_t len ;
+            while ((len = ::read(fd, buffer, sizeof(buffer))) > 0) {
+                for (char* ptr = buffer; ptr < buffer + len; ) {
+                    const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(ptr) ;
+                    if ((event->len > 0) && (base == event->name)) changed = true ;
+                    ptr += sizeof(struct inotify_event) + event->len ;
+                }
+            }
+            if (changed) Reload() ;
+        }
+        ::close(fd) ;
+        return ;
+    }
+    if (fd >= 0) ::close(fd) ;
+#endif
+
+    // Otherwise check the modification time of the file periodically
+    struct stat info ;
+    struct timespec last_mtime = {0, 0} ;
+    if (::stat(filename_.c_str(), &info) == 0) last_mtime = ModificationTime(info) ;
+    while (running_.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(CLOPT_WATCH_POLL_INTERVAL)) ;
+        if (::stat(filename_.c_str(), &info) != 0) continue ;
+        struct timespec mtime = ModificationTime(info) ;
+        if ((mtime.tv_sec != last_mtime.tv_sec) || (mtime.tv_nsec != last_mtime.tv_nsec)) {
+            last_mtime = mtime ;
+            Reload() ;
+        }
+    }
+}
+
+#endif /* CLOptionsWatcher_h */